@@ -0,0 +1,102 @@
+// Example source plugin: a beam entering the domain through the z = 0 face
+// along +z, with a Gaussian profile and divergence. Build it with
+// 'make beam_source.so' and run with
+//   ./transport -mode forward -source_plugin ./beam_source.so
+//      -source_plugin_args x0,y0,sigma,divergence,energy
+// where (x0, y0) is the beam center, sigma the profile width (cm), divergence
+// the angular spread (radians) and energy the beam energy (MeV). Missing
+// arguments default to a beam at the center of the face.
+
+#include "source_plugin.h"
+#include<math.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+#define PI 3.1415926535898
+
+typedef struct Beam_{
+  double x0; // beam center
+  double y0;
+  double sigma; // width of the profile
+  double divergence; // angular spread
+  double energy;
+  double L[3]; // extent of the domain
+} Beam;
+
+int source_version(void)
+{
+  return SOURCE_PLUGIN_VERSION;
+}
+
+int source_init(const char *args, const double *L, void **state)
+{
+  Beam *b = malloc(sizeof(Beam));
+
+  b->x0 = L[0]/2;
+  b->y0 = L[1]/2;
+  b->sigma = L[0]/20;
+  b->divergence = 0.01;
+  b->energy = 14.1;
+  b->L[0] = L[0];
+  b->L[1] = L[1];
+  b->L[2] = L[2];
+  if(args != NULL){
+    sscanf(args, "%lf,%lf,%lf,%lf,%lf", &b->x0, &b->y0, &b->sigma, &b->divergence, &b->energy);
+  }
+  if(b->sigma < 0 || b->divergence < 0 || b->x0 < 0 || b->x0 > L[0] || b->y0 < 0 || b->y0 > L[1]){
+    free(b);
+    return 1;
+  }
+
+  *state = b;
+
+  return 0;
+}
+
+// Pair of standard normal numbers by the Box-Muller transform
+static void normal_pair(unsigned long long *seed, double *a, double *b)
+{
+  double r = sqrt(-2*log(1 - source_rn(seed)));
+  double phi = 2*PI*source_rn(seed);
+
+  *a = r*cos(phi);
+  *b = r*sin(phi);
+}
+
+int source_sample(void *state, Source_Sites *sites)
+{
+  unsigned long i;
+  unsigned long long seed;
+  double a, b, theta, phi;
+  Beam *beam = state;
+
+  for(i=0; i<sites->n; i++){
+    seed = sites->seed[i];
+
+    // Resample the part of the profile that misses the face
+    do{
+      normal_pair(&seed, &a, &b);
+      sites->x[i] = beam->x0 + beam->sigma*a;
+      sites->y[i] = beam->y0 + beam->sigma*b;
+    } while(sites->x[i] < 0 || sites->x[i] > beam->L[0] ||
+       sites->y[i] < 0 || sites->y[i] > beam->L[1]);
+    sites->z[i] = 0;
+
+    normal_pair(&seed, &a, &b);
+    theta = beam->divergence*fabs(a);
+    phi = 2*PI*source_rn(&seed);
+    sites->u[i] = sin(theta)*cos(phi);
+    sites->v[i] = sin(theta)*sin(phi);
+    sites->w[i] = cos(theta);
+
+    sites->energy[i] = beam->energy;
+    sites->weight[i] = 1;
+  }
+
+  return 0;
+}
+
+void source_free(void *state)
+{
+  free(state);
+}
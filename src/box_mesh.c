@@ -0,0 +1,90 @@
+#include "simple_mc.h"
+
+// Writes a tetrahedral mesh of an Lx by Ly by Lz box of one material in the
+// layout load_mesh reads, so the mesh geometry can be checked against the box
+// it replaces. Each of the n*n*n cells of the box is cut into six tets around
+// the diagonal from its lower to its upper corner; every cell is cut the same
+// way, so the faces of neighboring cells match up. Built with 'make box_mesh'
+// and run as
+//   ./box_mesh n Lx Ly Lz xs_f xs_a xs_s mesh_file
+
+// Order in which the six tets of a cell step along the axes from the lower to
+// the upper corner
+static const int STEPS[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+
+int main(int argc, char *argv[])
+{
+  long n, i, j, k, n_nodes, n_tets;
+  int s, a, n_materials = 1;
+  int c[3];
+  long tet[4];
+  double L[3], xs[3], x[3];
+  int material = 0;
+  FILE *fp;
+
+  if(argc != 9){
+    print_error("Usage: ./box_mesh n Lx Ly Lz xs_f xs_a xs_s mesh_file");
+  }
+  n = atol(argv[1]);
+  for(a=0; a<3; a++){
+    L[a] = atof(argv[2+a]);
+    xs[a] = atof(argv[5+a]);
+  }
+  if(n < 1 || L[0] <= 0 || L[1] <= 0 || L[2] <= 0){
+    print_error("Mesh needs at least one cell and positive dimensions");
+  }
+  if(n > 1000 || 6*n*n*n > MAX_TETS){
+    print_error("Mesh has more tets than a particle can index (2^31 - 1).");
+  }
+
+  fp = fopen(argv[8], "wb");
+  if(fp == NULL){
+    print_error("Couldn't open mesh file.");
+  }
+
+  n_nodes = (n+1)*(n+1)*(n+1);
+  n_tets = 6*n*n*n;
+  fwrite(&n_nodes, sizeof(long), 1, fp);
+  fwrite(&n_tets, sizeof(long), 1, fp);
+  fwrite(&n_materials, sizeof(int), 1, fp);
+  fwrite(xs, sizeof(double), 3, fp);
+
+  // Node (i, j, k) is number (i*(n+1) + j)*(n+1) + k
+  for(i=0; i<=n; i++){
+    for(j=0; j<=n; j++){
+      for(k=0; k<=n; k++){
+        x[0] = L[0]*i/n;
+        x[1] = L[1]*j/n;
+        x[2] = L[2]*k/n;
+        fwrite(x, sizeof(double), 3, fp);
+      }
+    }
+  }
+
+  for(i=0; i<n; i++){
+    for(j=0; j<n; j++){
+      for(k=0; k<n; k++){
+        for(s=0; s<6; s++){
+          c[0] = c[1] = c[2] = 0;
+          tet[0] = (i*(n+1) + j)*(n+1) + k;
+          for(a=0; a<3; a++){
+            c[STEPS[s][a]]++;
+            tet[a+1] = ((i+c[0])*(n+1) + j+c[1])*(n+1) + k+c[2];
+          }
+          fwrite(tet, sizeof(long), 4, fp);
+        }
+      }
+    }
+  }
+
+  for(i=0; i<n_tets; i++){
+    fwrite(&material, sizeof(int), 1, fp);
+  }
+
+  if(fclose(fp) != 0){
+    print_error("Error writing mesh file.");
+  }
+  printf("Wrote %s: %ld nodes, %ld tets\n", argv[8], n_nodes, n_tets);
+
+  return 0;
+}
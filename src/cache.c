@@ -0,0 +1,305 @@
+#include "simple_mc.h"
+#include<dirent.h>
+#include<utime.h>
+#include<sys/stat.h>
+
+// Cache of converged source banks shared between runs. Each entry is a file
+// in the cache directory holding a header and the source sites. The discrete
+// parameters of a problem (geometry type, boundary conditions, mesh) must
+// match exactly and are hashed into a key; among the entries with the same key
+// the one nearest in the continuous parameters (dimensions, cross sections,
+// nu) is used.
+
+#define N_CONTINUOUS 7
+
+// Identifies a cache entry and its layout version
+static const char MAGIC[8] = "SMCSRC1";
+
+typedef struct Cache_Header_{
+  char magic[8];
+  unsigned long long key; // hash of the discrete parameters
+  double c[N_CONTINUOUS]; // continuous parameters
+  unsigned long n; // number of sites
+} Cache_Header;
+
+typedef struct Cache_File_{
+  char *path;
+  off_t sz;
+  time_t mtime;
+} Cache_File;
+
+// 64-bit FNV-1a hash of n bytes, continuing from hash h
+static unsigned long long fnv1a(unsigned long long h, const void *data, size_t n)
+{
+  size_t i;
+  const unsigned char *b = data;
+
+  for(i=0; i<n; i++){
+    h ^= b[i];
+    h *= 1099511628211ULL;
+  }
+
+  return h;
+}
+
+// Fills the header that identifies the problem being run
+static void fingerprint(Parameters *parameters, Geometry *geometry, Cache_Header *h)
+{
+  unsigned long long key = 14695981039346656037ULL;
+  struct stat st;
+
+  key = fnv1a(key, &(geometry->type), sizeof(int));
+  key = fnv1a(key, &(geometry->bc), sizeof(int));
+  key = fnv1a(key, &(geometry->symmetry), sizeof(int));
+  key = fnv1a(key, &(parameters->n_nuclides), sizeof(int));
+  if(geometry->type == TET_MESH){
+    key = fnv1a(key, parameters->mesh_file, strlen(parameters->mesh_file));
+    if(stat(parameters->mesh_file, &st) == 0){
+      key = fnv1a(key, &(st.st_size), sizeof(off_t));
+    }
+  }
+
+  memcpy(h->magic, MAGIC, 8);
+  h->key = key;
+  h->c[0] = geometry->Lx;
+  h->c[1] = geometry->Ly;
+  h->c[2] = geometry->Lz;
+  h->c[3] = parameters->xs_f;
+  h->c[4] = parameters->xs_a;
+  h->c[5] = parameters->xs_s;
+  h->c[6] = parameters->nu;
+  h->n = 0;
+
+  return;
+}
+
+// Largest relative difference between the continuous parameters of two
+// problems
+static double distance(Cache_Header *a, Cache_Header *b)
+{
+  int i;
+  double d = 0, scale, rel;
+
+  for(i=0; i<N_CONTINUOUS; i++){
+    scale = fabs(a->c[i]) > fabs(b->c[i]) ? fabs(a->c[i]) : fabs(b->c[i]);
+    rel = scale > 0 ? fabs(a->c[i] - b->c[i])/scale : 0;
+    if(rel > d) d = rel;
+  }
+
+  return d;
+}
+
+static char *entry_path(char *dir, char *name)
+{
+  char *path = malloc(strlen(dir) + strlen(name) + 2);
+
+  sprintf(path, "%s/%s", dir, name);
+
+  return path;
+}
+
+// Lists the entries in the cache directory
+static Cache_File *list_cache(char *dir, int *n)
+{
+  int sz = 0;
+  char *path;
+  DIR *d;
+  struct dirent *e;
+  struct stat st;
+  Cache_File *files = NULL;
+
+  *n = 0;
+  d = opendir(dir);
+  if(d == NULL) return NULL;
+
+  while((e = readdir(d)) != NULL){
+    if(strlen(e->d_name) < 4 || strcmp(e->d_name + strlen(e->d_name) - 4, ".src") != 0){
+      continue;
+    }
+    path = entry_path(dir, e->d_name);
+    if(stat(path, &st) != 0){
+      free(path);
+      continue;
+    }
+    if(*n == sz){
+      sz = sz == 0 ? 16 : 2*sz;
+      files = realloc(files, sz*sizeof(Cache_File));
+    }
+    files[*n].path = path;
+    files[*n].sz = st.st_size;
+    files[*n].mtime = st.st_mtime;
+    (*n)++;
+  }
+  closedir(d);
+
+  return files;
+}
+
+static void free_list(Cache_File *files, int n)
+{
+  int i;
+
+  for(i=0; i<n; i++){
+    free(files[i].path);
+  }
+  free(files);
+
+  return;
+}
+
+// Fills the source bank from the nearest cached source, resampled to
+// n_particles sites with a systematic sample. On a box the sites are scaled to
+// the new dimensions. Returns FALSE if no entry is within the tolerance.
+int load_cached_source(Parameters *parameters, Geometry *geometry, Bank *b)
+{
+  int i, n_files;
+  int best = -1;
+  unsigned long j, k;
+  double d, d_best = D_INF;
+  double offset;
+  double scale[3];
+  Cache_Header h, e;
+  Cache_File *files;
+  Particle *sites;
+  FILE *fp;
+
+  fingerprint(parameters, geometry, &h);
+
+  // Find the nearest entry with the same key
+  files = list_cache(parameters->source_cache, &n_files);
+  for(i=0; i<n_files; i++){
+    fp = fopen(files[i].path, "rb");
+    if(fp == NULL) continue;
+    if(fread(&e, sizeof(Cache_Header), 1, fp) == 1 &&
+       memcmp(e.magic, MAGIC, 8) == 0 && e.key == h.key && e.n > 0){
+      d = distance(&h, &e);
+      if(d <= parameters->cache_tolerance && d < d_best){
+        d_best = d;
+        best = i;
+      }
+    }
+    fclose(fp);
+  }
+
+  if(best < 0){
+    free_list(files, n_files);
+    return FALSE;
+  }
+
+  fp = fopen(files[best].path, "rb");
+  if(fp == NULL || fread(&e, sizeof(Cache_Header), 1, fp) != 1){
+    print_error("Error reading cached source.");
+  }
+  sites = malloc(e.n*sizeof(Particle));
+  if(fread(sites, sizeof(Particle), e.n, fp) != e.n){
+    print_error("Error reading cached source.");
+  }
+  fclose(fp);
+
+  // Mark the entry as recently used for eviction
+  utime(files[best].path, NULL);
+
+  for(i=0; i<3; i++){
+    scale[i] = geometry->type == BOX ? h.c[i]/e.c[i] : 1;
+  }
+
+  // Systematic sample of n_particles sites with a single random offset
+  while(b->sz < parameters->n_particles){
+    b->resize(b);
+  }
+  offset = rn();
+  for(j=0; j<parameters->n_particles; j++){
+    k = (j + offset)*e.n/parameters->n_particles;
+    if(k >= e.n) k = e.n - 1;
+    copy_particle(&(b->p[j]), &(sites[k]));
+    b->p[j].x *= scale[0];
+    b->p[j].y *= scale[1];
+    b->p[j].z *= scale[2];
+    b->p[j].weight = 1;
+    b->p[j].alive = TRUE;
+  }
+  b->n = parameters->n_particles;
+
+  printf("Starting from cached source %s (%lu sites, %.2g%% from this problem)\n",
+     files[best].path, e.n, 100*d_best);
+
+  free(sites);
+  free_list(files, n_files);
+
+  return TRUE;
+}
+
+// Removes the least recently used entries until the cache fits in cache_size
+// MB, always keeping the entry at keep
+static void evict(Parameters *parameters, char *keep)
+{
+  int i, n_files, oldest;
+  double total = 0;
+  Cache_File *files;
+
+  files = list_cache(parameters->source_cache, &n_files);
+  for(i=0; i<n_files; i++){
+    total += files[i].sz;
+  }
+
+  while(total > parameters->cache_size*1.0e6){
+    oldest = -1;
+    for(i=0; i<n_files; i++){
+      if(files[i].path == NULL || strcmp(files[i].path, keep) == 0) continue;
+      if(oldest < 0 || files[i].mtime < files[oldest].mtime) oldest = i;
+    }
+    if(oldest < 0) break;
+    remove(files[oldest].path);
+    total -= files[oldest].sz;
+    free(files[oldest].path);
+    files[oldest].path = NULL;
+  }
+
+  free_list(files, n_files);
+
+  return;
+}
+
+// Stores the converged source bank under the fingerprint of the problem,
+// replacing an earlier entry for exactly the same parameters
+void store_cached_source(Parameters *parameters, Geometry *geometry, Bank *b)
+{
+  char name[32];
+  char *path, *tmp;
+  Cache_Header h;
+  FILE *fp;
+
+  set_phase(PHASE_IO);
+
+  fingerprint(parameters, geometry, &h);
+  h.n = b->n;
+
+  mkdir(parameters->source_cache, 0755);
+
+  sprintf(name, "%016llx.src", fnv1a(h.key, h.c, sizeof(h.c)));
+  path = entry_path(parameters->source_cache, name);
+  tmp = malloc(strlen(path) + 5);
+  sprintf(tmp, "%s.tmp", path);
+
+  fp = fopen(tmp, "wb");
+  if(fp == NULL){
+    printf("Warning: couldn't write to source cache %s\n", parameters->source_cache);
+    free(tmp);
+    free(path);
+    return;
+  }
+  if(fwrite(&h, sizeof(Cache_Header), 1, fp) != 1 ||
+     fwrite(b->p, sizeof(Particle), b->n, fp) != b->n ||
+     fclose(fp) != 0 || rename(tmp, path) != 0){
+    printf("Warning: couldn't write to source cache %s\n", parameters->source_cache);
+    remove(tmp);
+  }
+  else{
+    evict(parameters, path);
+  }
+
+  free(tmp);
+  free(path);
+
+  return;
+}
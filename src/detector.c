@@ -0,0 +1,82 @@
+#include "simple_mc.h"
+
+// Optical depth along the straight line from the particle's position to the
+// point x, found by tracing the ray through the geometry. Only the direct
+// flight is scored, so read_CLI() allows the detector only inside a domain
+// with vacuum boundaries and no symmetry, where no reflected or periodic image
+// of the flight reaches it. On a box the one material fills the convex domain
+// and the whole segment lies in it. On a tet mesh the ray walks the tets from
+// the particle's tet, and a ray that leaves the mesh never reaches x.
+double optical_depth(Geometry *geometry, Material *material, Particle *p, double *x)
+{
+  double r[3] = {x[0] - p->x, x[1] - p->y, x[2] - p->z};
+  double dist = sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2]);
+  double tau = 0;
+  double d, xs;
+  long next;
+  Mesh *m = geometry->mesh;
+  Particle q;
+
+  if(GEOMETRY_TYPE(geometry) != TET_MESH){
+    return XS_T(material)*dist;
+  }
+  if(dist == 0){
+    return 0;
+  }
+
+  copy_particle(&q, p);
+  q.u = r[0]/dist;
+  q.v = r[1]/dist;
+  q.w = r[2]/dist;
+
+  while(TRUE){
+    d = distance_to_tet_face(m, &q);
+    xs = material[m->material[q.cell]].xs_t;
+    if(d >= dist){
+      return tau + xs*dist;
+    }
+    tau += xs*d;
+    dist -= d;
+    q.x = q.x + d*q.u;
+    q.y = q.y + d*q.v;
+    q.z = q.z + d*q.w;
+
+    next = m->neighbor[4*q.cell + q.surface_crossed];
+    if(next < 0){
+      return D_INF;
+    }
+    q.cell = next/4;
+  }
+}
+
+// Next-event estimator of the flux at the point detector. A particle about to
+// be emitted isotropically from its position, with probability ratio,
+// contributes the chance of its next flight reaching the detector uncollided,
+// weight*ratio*exp(-tau)/(4 pi R^2). Within the exclusion radius R0 the 1/R^2
+// singularity, which makes the variance infinite, is replaced by the kernel
+// averaged over the sphere of radius R0, 3(1 - exp(-xs R0))/(4 pi xs R0^3).
+void score_point_detector(Parameters *parameters, Geometry *geometry, Material *material, Tally *t, Particle *p, double ratio)
+{
+  double r[3] = {t->detector[0] - p->x, t->detector[1] - p->y, t->detector[2] - p->z};
+  double R2 = r[0]*r[0] + r[1]*r[1] + r[2]*r[2];
+  double R0 = parameters->exclusion_radius;
+  double xs, k;
+
+  if(R2 < R0*R0){
+    xs = GEOMETRY_TYPE(geometry) == TET_MESH ?
+       XS_T(&(material[geometry->mesh->material[p->cell]])) : XS_T(material);
+    if(xs > 0){
+      k = 3*(1 - exp(-xs*R0))/(4*PI*xs*R0*R0*R0);
+    }
+    else{
+      k = 3/(4*PI*R0*R0);
+    }
+  }
+  else{
+    k = exp(-optical_depth(geometry, material, p, t->detector))/(4*PI*R2);
+  }
+
+  t->point_flux += p->weight*ratio*k/parameters->n_particles;
+
+  return;
+}
@@ -1,79 +1,390 @@
 #include "simple_mc.h"
 
-void run_eigenvalue(Parameters *parameters, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally, double *keff)
+// Number of generations after which the fission chains of a fixed source
+// batch are taken to never die out
+#define MAX_CHAIN_GENERATIONS 10000
+
+// State shared by the threads of the pool during a generation
+typedef struct Generation_{
+  Parameters *parameters;
+  Geometry *geometry;
+  Material *material;
+  Bank *source_bank;
+  Bank **fission_banks; // fission bank of each thread, thread 0 uses the global bank
+  Tally **tallies; // tally of each thread, thread 0 uses the global tally
+  unsigned long *offset; // index of each thread's first site in the global bank
+  unsigned long n_done; // number of particles simulated in earlier generations
+  int n_threads;
+  int abandon; // set when the generation is given up at shutdown
+} Generation;
+
+// Transports a contiguous block of the source bank on each thread. Since the
+// blocks are merged back in thread order, the fission bank ends up in the same
+// order as a serial run.
+static void transport_task(void *arg, int id)
+{
+  Generation *g = arg;
+  unsigned long i_p; // index over particles
+  unsigned long n = g->source_bank->n;
+  unsigned long start = n*id/g->n_threads;
+  unsigned long end = n*(id+1)/g->n_threads;
+  double t_start = timer();
+  Particle p;
+
+  // Set RNG stream for tracking
+  set_stream(STREAM_TRACK);
+
+  g->tallies[id]->tallies_on = g->tallies[0]->tallies_on;
+
+  // Loop over particles
+  for(i_p=start; i_p<end; i_p++){
+
+    // Give up the generation if a shutdown was requested and it can't finish
+    // before the deadline
+    if(shutdown_requested == TRUE){
+      if(__atomic_load_n(&g->abandon, __ATOMIC_RELAXED) == FALSE &&
+         past_deadline(g->parameters, i_p - start, end - i_p, t_start) == TRUE){
+        __atomic_store_n(&g->abandon, TRUE, __ATOMIC_RELAXED);
+      }
+      if(__atomic_load_n(&g->abandon, __ATOMIC_RELAXED) == TRUE) break;
+    }
+
+    // Set seed for particle i_p by skipping ahead in the random number
+    // sequence stride*(total particles simulated) numbers from the initial
+    // seed. This allows for reproducibility of the particle history.
+    rn_skip(g->n_done + i_p);
+
+    // Copy next particle into p
+    copy_particle(&p, &(g->source_bank->p[i_p]));
+
+    // Transport the next particle
+    transport(g->parameters, g->geometry, g->material, g->source_bank, g->fission_banks[id], g->tallies[id], &p);
+  }
+
+  // Switch RNG stream off tracking
+  set_stream(STREAM_OTHER);
+
+  return;
+}
+
+// Copies each thread's fission sites into the global fission bank and reduces
+// a slice of the thread tallies into the global tally. The bank, and so keff,
+// comes out the same for any number of threads, but the tallies do not: each
+// thread sums the scores of its own block first, so the rounding of the flux
+// and cost sums changes with the thread count.
+static void merge_task(void *arg, int id)
+{
+  Generation *g = arg;
+  unsigned long i, start, end;
+  int i_t;
+  Tally *t = g->tallies[0];
+  Bank *b = g->fission_banks[id];
+
+  if(id > 0){
+    memcpy(&(g->fission_banks[0]->p[g->offset[id]]), b->p, b->n*sizeof(Particle));
+    b->n = 0;
+  }
+
+  if(t->tallies_on == TRUE && g->n_threads > 1){
+    start = t->sz*id/g->n_threads;
+    end = t->sz*(id+1)/g->n_threads;
+    for(i_t=1; i_t<g->n_threads; i_t++){
+      for(i=start; i<end; i++){
+        t->flux[i] += g->tallies[i_t]->flux[i];
+        g->tallies[i_t]->flux[i] = 0;
+      }
+    }
+  }
+
+  // The cost map is kept over every generation, tallying or not
+  if(t->cost != NULL && g->n_threads > 1){
+    start = N_COSTS*t->sz*id/g->n_threads;
+    end = N_COSTS*t->sz*(id+1)/g->n_threads;
+    for(i_t=1; i_t<g->n_threads; i_t++){
+      for(i=start; i<end; i++){
+        t->cost[i] += g->tallies[i_t]->cost[i];
+        g->tallies[i_t]->cost[i] = 0;
+      }
+    }
+  }
+
+  return;
+}
+
+// Number of grid boxes in each dimension of the entropy mesh for n sites
+static unsigned long entropy_grid(unsigned long n_sites)
+{
+  return ceil(pow(n_sites/20, 1.0/3.0));
+}
+
+// Sizes the main thread's scratch arena once for the largest source bank the
+// run can produce. The entropy counters shared by the threads and the source
+// distribution both live there.
+static void reserve_scratch(Parameters *parameters, Arena *scratch)
+{
+  unsigned long n_max = parameters->n_particles;
+  unsigned long n;
+  size_t sz;
+
+  if(parameters->population_control == COMB){
+    n_max = (1 + parameters->population_float)*parameters->n_particles;
+  }
+
+  // Entropy counters
+  n = entropy_grid(n_max);
+  sz = n*n*n*sizeof(unsigned long);
+
+  // Source distribution
+  n = parameters->n_bins;
+  if(parameters->write_source == TRUE && n*n*n*sizeof(double) > sz){
+    sz = n*n*n*sizeof(double);
+  }
+
+  arena_reserve(scratch, (sz + 63) & ~(size_t)63);
+
+  return;
+}
+
+// Sets up the state of a generation with a fission bank and tally for each
+// thread of the pool; thread 0 uses the global ones
+static void init_generation(Generation *g, Parameters *parameters, Pool *pool, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally)
+{
+  int i_t;
+
+  g->parameters = parameters;
+  g->geometry = geometry;
+  g->material = material;
+  g->source_bank = source_bank;
+  g->n_threads = pool->n_threads;
+  g->n_done = 0;
+  g->fission_banks = malloc(g->n_threads*sizeof(Bank*));
+  g->tallies = malloc(g->n_threads*sizeof(Tally*));
+  g->offset = calloc(g->n_threads, sizeof(unsigned long));
+  g->fission_banks[0] = fission_bank;
+  g->tallies[0] = tally;
+  for(i_t=1; i_t<g->n_threads; i_t++){
+    g->fission_banks[i_t] = init_bank(2*parameters->n_particles/g->n_threads + 1);
+    g->tallies[i_t] = malloc(sizeof(Tally));
+    *g->tallies[i_t] = *tally;
+    g->tallies[i_t]->flux = NULL;
+    g->tallies[i_t]->region_batch = NULL;
+    g->tallies[i_t]->point_batch = NULL;
+    if(tally->surface != NULL){
+      g->tallies[i_t]->surface = init_bank(1024);
+    }
+    if(parameters->tally == TRUE || parameters->mode != EIGENVALUE ||
+       parameters->surface_write != NO_SURFACE || parameters->depletion_steps > 0){
+      g->tallies[i_t]->flux = huge_calloc(tally->sz, sizeof(double));
+    }
+    if(tally->material_flux != NULL){
+      g->tallies[i_t]->material_flux = calloc(tally->n_materials, sizeof(double));
+    }
+    if(tally->cost != NULL){
+      g->tallies[i_t]->cost = calloc(N_COSTS*tally->sz, sizeof(double));
+    }
+  }
+
+  return;
+}
+
+static void free_generation(Generation *g)
+{
+  int i_t;
+
+  for(i_t=1; i_t<g->n_threads; i_t++){
+    free_bank(g->fission_banks[i_t]);
+    free_tally(g->tallies[i_t]);
+  }
+  free(g->fission_banks);
+  free(g->tallies);
+  free(g->offset);
+
+  return;
+}
+
+// Transports the source bank on the pool and gathers the fission sites and
+// tallies of every thread into the global bank and tally
+static void run_generation(Pool *pool, Generation *g)
+{
+  int i_t;
+  int i_m; // index over materials
+  unsigned long n_f = 0;
+  Bank *fission_bank = g->fission_banks[0];
+  Tally *tally = g->tallies[0];
+
+  g->abandon = FALSE;
+  set_phase(PHASE_TRANSPORT);
+  pool_run(pool, transport_task, g);
+  if(g->abandon == TRUE) return;
+  pool->n_histories += g->source_bank->n;
+  pool->n_generations++;
+
+  for(i_t=0; i_t<g->n_threads; i_t++){
+    g->offset[i_t] = n_f;
+    n_f += g->fission_banks[i_t]->n;
+  }
+  set_phase(PHASE_SYNC);
+  while(n_f > fission_bank->sz){
+    fission_bank->resize(fission_bank);
+  }
+  pool_run(pool, merge_task, g);
+  fission_bank->n = n_f;
+  for(i_t=1; i_t<g->n_threads; i_t++){
+    tally->region_flux += g->tallies[i_t]->region_flux;
+    g->tallies[i_t]->region_flux = 0;
+    tally->point_flux += g->tallies[i_t]->point_flux;
+    g->tallies[i_t]->point_flux = 0;
+    if(tally->material_flux != NULL){
+      for(i_m=0; i_m<tally->n_materials; i_m++){
+        tally->material_flux[i_m] += g->tallies[i_t]->material_flux[i_m];
+        g->tallies[i_t]->material_flux[i_m] = 0;
+      }
+    }
+  }
+
+  return;
+}
+
+int run_eigenvalue(Parameters *parameters, Pool *pool, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally, double *keff)
 {
   int i_b; // index over batches
   int i_a = -1; // index over active batches
   int i_g; // index over generations
-  unsigned long i_p; // index over particles
   double keff_gen = 1; // keff of generation
-  double keff_batch; // keff of batch
+  double keff_batch = 0; // keff of batch
   double keff_mean; // keff mean over active batches
   double keff_std; // keff standard deviation over active batches
-  double H; // shannon entropy
-  Particle p;
+  double H = 0; // shannon entropy
+  int i_b0 = 0; // batch the run starts in
+  int i_g0 = 0; // generation of that batch the run starts at
+  int resumed; // whether the batch was started by a preempted run
+  int stopped = FALSE; // whether the run stopped early for a shutdown
+  double *flux_start = NULL; // tally at the start of the generation
+  double region_flux_start = 0;
+  double point_flux_start = 0;
+  Restart r;
+  Generation g;
+
+  // Set up the per-thread fission banks and tallies once for the whole run
+  init_generation(&g, parameters, pool, geometry, material, source_bank, fission_bank, tally);
+  reserve_scratch(parameters, pool->scratch);
+
+  // Pick up where a preempted run left off
+  if(parameters->resume == TRUE){
+    read_restart(parameters, &r, source_bank, tally, keff);
+    i_b0 = r.i_b;
+    i_g0 = r.i_g;
+    i_a = r.i_a;
+    g.n_done = r.n_done;
+    keff_batch = r.keff_batch;
+    H = r.H;
+    set_seed(r.seed);
+  }
+
+  // Keep the tally at the start of each generation after the first of a
+  // batch, so a generation given up at shutdown can be rolled back
+  if(parameters->tally == TRUE && parameters->n_generations > 1){
+    flux_start = huge_malloc(tally->sz*sizeof(double));
+  }
 
   // Loop over batches
-  for(i_b=0; i_b<parameters->n_batches; i_b++){
+  for(i_b=i_b0; i_b<parameters->n_batches; i_b++){
+
+    resumed = parameters->resume == TRUE && i_b == i_b0;
 
-    keff_batch = 0;
+    if(resumed == FALSE){
+      keff_batch = 0;
 
-    // Write coordinates of particles in source bank
-    if(parameters->write_bank == TRUE){
-      write_bank(source_bank, parameters->bank_file);
+      // Write coordinates of particles in source bank
+      if(parameters->write_bank == TRUE){
+        write_bank(source_bank, parameters->bank_file);
+      }
     }
 
     // Turn on tallying and increment index in active batches
     if(i_b >= parameters->n_batches - parameters->n_active){
-      i_a++;
-      if(parameters->tally == TRUE){
+      if(resumed == FALSE){
+        i_a++;
+      }
+      if(parameters->tally == TRUE || parameters->surface_write != NO_SURFACE ||
+         parameters->depletion_steps > 0){
         tally->tallies_on = TRUE;
       }
     }
 
     // Loop over generations
-    for(i_g=0; i_g<parameters->n_generations; i_g++){
-
-      // Set RNG stream for tracking
-      set_stream(STREAM_TRACK);
+    for(i_g=(resumed == TRUE ? i_g0 : 0); i_g<parameters->n_generations; i_g++){
 
-      // Loop over particles
-      for(i_p=0; i_p<parameters->n_particles; i_p++){
-
-	// Set seed for particle i_p by skipping ahead in the random number
-	// sequence stride*(total particles simulated) numbers from the initial
-	// seed. This allows for reproducibility of the particle history.
-        rn_skip((i_b*parameters->n_generations + i_g)*parameters->n_particles + i_p);
+      // Stop at the generation boundary once a shutdown is requested
+      if(shutdown_requested == TRUE){
+        stopped = TRUE;
+        break;
+      }
 
-        // Copy next particle into p
-        copy_particle(&p, &(source_bank->p[i_p]));
+      if(flux_start != NULL && tally->tallies_on == TRUE && i_g > 0){
+        memcpy(flux_start, tally->flux, tally->sz*sizeof(double));
+        region_flux_start = tally->region_flux;
+        point_flux_start = tally->point_flux;
+      }
 
-        // Transport the next particle
-        transport(parameters, geometry, material, source_bank, fission_bank, tally, &p);
+      // Transport the source bank on the pool and gather the fission sites
+      run_generation(pool, &g);
+
+      // A generation given up at shutdown leaves the source bank untouched;
+      // roll the tally back to where it was when the generation started
+      if(g.abandon == TRUE){
+        if(tally->tallies_on == TRUE){
+          if(i_g > 0){
+            memcpy(tally->flux, flux_start, tally->sz*sizeof(double));
+            tally->region_flux = region_flux_start;
+            tally->point_flux = point_flux_start;
+          }
+          else{
+            memset(tally->flux, 0, tally->sz*sizeof(double));
+            tally->region_flux = 0;
+            tally->point_flux = 0;
+          }
+        }
+        stopped = TRUE;
+        break;
       }
 
-      // Switch RNG stream off tracking
-      set_stream(STREAM_OTHER);
+      // Append the particles that crossed the surface in this generation
+      if(tally->surface != NULL && tally->tallies_on == TRUE){
+        write_surface_sites(parameters, g.tallies, g.n_threads, parameters->n_particles);
+      }
 
       // Calculate generation k_effective and accumulate batch k_effective
-      keff_gen = (double) fission_bank->n / source_bank->n;
+      keff_gen = bank_weight(fission_bank) / bank_weight(source_bank);
       keff_batch += keff_gen;
+      g.n_done += source_bank->n;
 
       // Sample new source particles from the particles that were added to the
       // fission bank during this generation
-      synchronize_bank(source_bank, fission_bank);
+      if(parameters->population_control == COMB){
+        comb_bank(parameters, source_bank, fission_bank);
+      }
+      else{
+        synchronize_bank(source_bank, fission_bank);
+      }
 
       // Calculate shannon entropy to assess source convergence
-      H = shannon_entropy(geometry, source_bank);
+      H = shannon_entropy(pool, geometry, source_bank);
       if(parameters->write_entropy == TRUE){
         write_entropy(H, parameters->entropy_file);
       }
 
       // Write the source distribution
       if(parameters->write_source == TRUE){
-        write_source(parameters, geometry, source_bank, parameters->source_file);
+        write_source(parameters, geometry, source_bank, pool->scratch, parameters->source_file);
       }
     }
+    if(stopped == TRUE) break;
+
+    // Store the source converged over the inactive batches for later runs
+    if(parameters->source_cache != NULL && i_b == parameters->n_batches - parameters->n_active - 1){
+      store_cached_source(parameters, geometry, source_bank);
+    }
 
     // Calculate k_effective
     keff_batch /= parameters->n_generations;
@@ -86,7 +397,11 @@ void run_eigenvalue(Parameters *parameters, Geometry *geometry, Material *materi
       if(parameters->write_tally == TRUE){
         write_tally(tally, parameters->tally_file);
       }
-      memset(tally->flux, 0, tally->n*tally->n*tally->n*sizeof(double));
+      memset(tally->flux, 0, tally->sz*sizeof(double));
+      tally->region_batch[i_a] = tally->region_flux;
+      tally->region_flux = 0;
+      tally->point_batch[i_a] = tally->point_flux;
+      tally->point_flux = 0;
     }
 
     // Calculate keff mean and standard deviation
@@ -101,16 +416,153 @@ void run_eigenvalue(Parameters *parameters, Geometry *geometry, Material *materi
     }
   }
 
-  // Write out keff
-  if(parameters->write_keff == TRUE){
-    write_keff(keff, parameters->n_active, parameters->keff_file);
+  // Save the state at the generation boundary to resume from
+  if(stopped == TRUE){
+    r.i_b = i_b;
+    r.i_g = i_g;
+    r.i_a = i_a;
+    r.n_done = g.n_done;
+    r.keff_batch = keff_batch;
+    r.H = H;
+    r.seed = get_seed();
+    write_restart(parameters, &r, source_bank, tally, keff);
+    printf("Shutdown requested: wrote %s to resume at batch %d, generation %d\n",
+       parameters->restart_file, i_b+1, i_g+1);
+  }
+  else{
+
+    // Write out keff
+    if(parameters->write_keff == TRUE){
+      write_keff(keff, parameters->n_active, parameters->keff_file);
+    }
+
+    if(parameters->save_source == TRUE){
+      save_source(source_bank);
+    }
+  }
+
+  free_generation(&g);
+  huge_free(flux_start);
+
+  return stopped == FALSE;
+}
+
+// Runs a fixed source problem in forward or adjoint mode. Each batch samples
+// n_particles source particles in the source box and transports them and all
+// the fission chains they start, one generation of the chain at a time. The
+// response of each batch is the flux integrated over the region per unit
+// source. In adjoint mode the adjoint source is the detector response, equal to
+// one over the detector volume, and the response is its flux integrated over
+// the source with the source density; in one group with isotropic scattering
+// the adjoint collision kernel is the forward one.
+int run_fixed_source(Parameters *parameters, Pool *pool, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally)
+{
+  int i_b; // index over batches
+  int i_g; // index over generations of the fission chains
+  unsigned long i_p; // index over particles
+  double mean; // response mean over batches
+  double std; // response standard deviation over batches
+  double scale = 1; // adjoint response per unit region flux
+  double *s = geometry->source;
+  double *r = geometry->region;
+  int stopped = FALSE; // whether the run stopped early for a shutdown
+  Bank tmp;
+  Generation g;
+  Surface_Source *surface = NULL;
+
+  init_generation(&g, parameters, pool, geometry, material, source_bank, fission_bank, tally);
+
+  if(parameters->surface_read == TRUE){
+    surface = read_surface_source(parameters->surface_file);
+    printf("Surface source: %lu sites from %g source particles, each used %d times\n",
+       surface->n, surface->n_histories, parameters->surface_reuse);
   }
 
-  if(parameters->save_source == TRUE){
-    save_source(source_bank);
+  // The adjoint particles start with unit weight over the detector volume and
+  // score per unit volume of the source
+  if(parameters->mode == ADJOINT){
+    scale = (s[1] - s[0])*(s[3] - s[2])*(s[5] - s[4]) /
+       ((r[1] - r[0])*(r[3] - r[2])*(r[5] - r[4]));
   }
 
-  return;
+  tally->tallies_on = TRUE;
+
+  for(i_b=0; i_b<parameters->n_batches; i_b++){
+
+    // Sample the source of this batch
+    if(surface != NULL){
+      sample_surface_source(parameters, geometry, surface, (unsigned long)i_b*parameters->n_particles, source_bank);
+    }
+    else if(geometry->plugin != NULL){
+      sample_plugin_source(geometry->plugin, geometry, (unsigned long)i_b*parameters->n_particles,
+         parameters->n_particles, source_bank);
+    }
+    else{
+      while(source_bank->sz < parameters->n_particles){
+        source_bank->resize(source_bank);
+      }
+      for(i_p=0; i_p<parameters->n_particles; i_p++){
+        sample_box_particle(geometry, geometry->source, &(source_bank->p[i_p]));
+      }
+      source_bank->n = parameters->n_particles;
+    }
+
+    // Follow the fission chains until they die out, transporting the sites
+    // banked by one generation as the next
+    for(i_g=0; source_bank->n > 0; i_g++){
+      if(i_g == MAX_CHAIN_GENERATIONS){
+        print_error("Fission chains didn't die out; is the fixed source problem supercritical?");
+      }
+      if(shutdown_requested == TRUE){
+        stopped = TRUE;
+        break;
+      }
+
+      run_generation(pool, &g);
+      if(g.abandon == TRUE){
+        stopped = TRUE;
+        break;
+      }
+      g.n_done += source_bank->n;
+
+      // Particles from the fission chains belong to the batch's histories
+      if(tally->surface != NULL){
+        write_surface_sites(parameters, g.tallies, g.n_threads, i_g == 0 ? parameters->n_particles : 0);
+      }
+
+      tmp = *source_bank;
+      *source_bank = *fission_bank;
+      *fission_bank = tmp;
+      fission_bank->n = 0;
+    }
+    if(stopped == TRUE) break;
+
+    // Tallies for this realization
+    if(parameters->write_tally == TRUE){
+      write_tally(tally, parameters->tally_file);
+    }
+    memset(tally->flux, 0, tally->sz*sizeof(double));
+    tally->region_batch[i_b] = scale*tally->region_flux;
+    tally->region_flux = 0;
+    tally->point_batch[i_b] = tally->point_flux;
+    tally->point_flux = 0;
+
+    // Status text
+    calculate_keff(tally->region_batch, &mean, &std, i_b+1);
+    printf("%-15d %-15d %-15e %e +/- %-15e\n", i_b+1, i_g, tally->region_batch[i_b],
+       mean, std/sqrt(i_b+1));
+  }
+
+  if(stopped == TRUE){
+    printf("Shutdown requested: stopped at batch %d\n", i_b+1);
+  }
+
+  free_generation(&g);
+  if(surface != NULL){
+    free_surface_source(surface);
+  }
+
+  return stopped == FALSE;
 }
 
 void synchronize_bank(Bank *source_bank, Bank *fission_bank)
@@ -119,6 +571,12 @@ void synchronize_bank(Bank *source_bank, Bank *fission_bank)
   unsigned long n_s = source_bank->n;
   unsigned long n_f = fission_bank->n;
 
+  set_phase(PHASE_SYNC);
+
+  if(n_f == 0){
+    print_error("No fission sites were banked, so there is no source for the next generation");
+  }
+
   // If the fission bank is larger than the source bank, randomly select
   // n_particles sites from the fission bank to create the new source bank
   if(n_f >= n_s){
@@ -157,49 +615,160 @@ void synchronize_bank(Bank *source_bank, Bank *fission_bank)
   return;
 }
 
+// Sum of the weights of the sites in a bank
+double bank_weight(Bank *b)
+{
+  unsigned long i;
+  double w = 0;
+
+  for(i=0; i<b->n; i++){
+    w += b->p[i].weight;
+  }
+
+  return w;
+}
+
+// Builds the new source bank from the fission bank by combing: n_particles
+// equally spaced teeth, with a single random offset, are laid over the
+// cumulative site weights and each tooth selects the site it lands in. This is
+// one sequential pass that handles weighted sites. When population_float is
+// set and the number of fission sites stays within that fraction of
+// n_particles, the sites are used as they are and only renormalized. Either
+// way the source bank carries a total weight of n_particles.
+void comb_bank(Parameters *parameters, Bank *source_bank, Bank *fission_bank)
+{
+  unsigned long i, j = 0;
+  unsigned long n = parameters->n_particles;
+  unsigned long n_f = fission_bank->n;
+  double w_f = bank_weight(fission_bank);
+  double spacing, offset, c = 0;
+
+  set_phase(PHASE_SYNC);
+
+  if(n_f == 0){
+    print_error("No fission sites were banked, so there is no source for the next generation");
+  }
+
+  // Let the population float within bounds
+  if(n_f >= (1 - parameters->population_float)*n &&
+     n_f <= (1 + parameters->population_float)*n){
+    while(source_bank->sz < n_f){
+      source_bank->resize(source_bank);
+    }
+    memcpy(source_bank->p, fission_bank->p, n_f*sizeof(Particle));
+    for(i=0; i<n_f; i++){
+      source_bank->p[i].weight *= n/w_f;
+    }
+    source_bank->n = n_f;
+    fission_bank->n = 0;
+    return;
+  }
+
+  // Comb the fission sites; each tooth carries a weight of w_f/n, which is
+  // renormalized to 1
+  spacing = w_f/n;
+  offset = rn()*spacing;
+  for(i=0; i<n_f && j<n; i++){
+    c += fission_bank->p[i].weight;
+    while(j<n && offset + j*spacing < c){
+      memcpy(&(source_bank->p[j]), &(fission_bank->p[i]), sizeof(Particle));
+      source_bank->p[j].weight = 1;
+      j++;
+    }
+  }
+
+  // Teeth lost to roundoff at the end of the comb land on the last site
+  for(; j<n; j++){
+    memcpy(&(source_bank->p[j]), &(fission_bank->p[n_f-1]), sizeof(Particle));
+    source_bank->p[j].weight = 1;
+  }
+
+  source_bank->n = n;
+  fission_bank->n = 0;
+
+  return;
+}
+
+// State shared by the threads of the pool while computing the entropy
+typedef struct Entropy_{
+  Geometry *geometry;
+  Bank *b;
+  unsigned long *count; // site counts shared by the threads
+  unsigned long n; // number of grid boxes in each dimension
+  int n_threads;
+} Entropy;
+
+// Clears a slice of the grid boxes
+static void entropy_zero_task(void *arg, int id)
+{
+  Entropy *e = arg;
+  unsigned long sz = e->n*e->n*e->n;
+  unsigned long start = sz*id/e->n_threads;
+  unsigned long end = sz*(id+1)/e->n_threads;
+
+  memset(&(e->count[start]), 0, (end - start)*sizeof(unsigned long));
+
+  return;
+}
+
+// Counts the sites of a contiguous block of the bank into the shared counters,
+// atomically when other threads are counting too
+static void entropy_count_task(void *arg, int id)
+{
+  Entropy *e = arg;
+  unsigned long n = e->n;
+  unsigned long start = e->b->n*id/e->n_threads;
+  unsigned long end = e->b->n*(id+1)/e->n_threads;
+  double d[3];
+
+  // Grid spacing
+  d[0] = e->geometry->Lx/n;
+  d[1] = e->geometry->Ly/n;
+  d[2] = e->geometry->Lz/n;
+
+  kernels.count_sites(&(e->b->p[start]), end - start, d, n, e->count, e->n_threads > 1);
+
+  return;
+}
+
 // Calculates the shannon entropy of the source distribution to assess
 // convergence
-double shannon_entropy(Geometry *geometry, Bank *b)
+double shannon_entropy(Pool *pool, Geometry *geometry, Bank *b)
 {
   unsigned long i;
   double H = 0.0;
-  double dx, dy, dz;
-  unsigned long ix, iy, iz;
-  unsigned long n;
   unsigned long *count;
-  Particle *p;
-
-  // Determine an appropriate number of grid boxes in each dimension
-  n = ceil(pow(b->n/20, 1.0/3.0));
-
-  // Find grid spacing
-  dx = geometry->Lx/n;
-  dy = geometry->Ly/n;
-  dz = geometry->Lz/n;
+  Entropy e;
 
-  // Allocate array to keep track of number of sites in each grid box
-  count = calloc(n*n*n, sizeof(unsigned long));
+  set_phase(PHASE_ENTROPY);
 
-  for(i=0; i<b->n; i++){
-    p = &(b->p[i]);
+  e.geometry = geometry;
+  e.b = b;
+  e.n_threads = pool->n_threads;
 
-    // Find the indices of the grid box of the particle
-    ix = p->x/dx;
-    iy = p->y/dy;
-    iz = p->z/dz;
+  // Determine an appropriate number of grid boxes in each dimension
+  e.n = entropy_grid(b->n);
 
-    count[ix*n*n + iy*n + iz]++;
+  // One set of counters in the main thread's arena, cleared by all threads
+  arena_reset(pool->scratch);
+  count = e.count = arena_alloc(pool->scratch, e.n*e.n*e.n*sizeof(unsigned long));
+  if(e.n_threads > 1){
+    pool_run(pool, entropy_zero_task, &e);
+  }
+  else{
+    memset(count, 0, e.n*e.n*e.n*sizeof(unsigned long));
   }
 
+  // Count the sites in each grid box
+  pool_run(pool, entropy_count_task, &e);
+
   // Calculate the shannon entropy
-  for(i=0; i<n*n*n; i++){
+  for(i=0; i<e.n*e.n*e.n; i++){
     if(count[i] > 0){
       H -= ((double)count[i]/b->n) * log2((double)count[i]/b->n);
     }
   }
 
-  free(count);
-
   return H;
 }
 
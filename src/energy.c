@@ -0,0 +1,119 @@
+#include "simple_mc.h"
+#include<glob.h>
+
+// Energy counters. The Linux powercap interface exposes the RAPL energy
+// counters of each cpu package, and of the DRAM attached to it, as
+// /sys/class/powercap/intel-rapl:N[:M]/energy_uj (also on AMD cpus). The
+// counters are in microjoules and wrap around at max_energy_range_uj. Core
+// and uncore domains are part of their package and aren't read.
+
+// Maximum number of RAPL domains read
+#define MAX_DOMAINS 32
+
+typedef struct Rapl_Domain_{
+  char *file; // path of the energy_uj counter
+  int dram; // whether the domain is DRAM rather than a package
+  unsigned long long last; // counter at the last read
+  unsigned long long range; // value the counter wraps around at
+} Rapl_Domain;
+
+static Rapl_Domain domains[MAX_DOMAINS];
+static int n_domains = 0;
+static double joules[2]; // package and DRAM energy since init_energy()
+
+// Reads an integer sysfs file, returning FALSE if it can't be read
+static int read_counter(const char *file, unsigned long long *v)
+{
+  FILE *fp = fopen(file, "r");
+  int ok;
+
+  if(fp == NULL) return FALSE;
+  ok = fscanf(fp, "%llu", v) == 1;
+  fclose(fp);
+
+  return ok ? TRUE : FALSE;
+}
+
+// Finds the package and DRAM domains whose counters are readable. Reading
+// them often needs root, so without any the run goes on without energy.
+void init_energy(Parameters *parameters)
+{
+  size_t i;
+  char file[512];
+  char name[64];
+  FILE *fp;
+  glob_t g;
+  Rapl_Domain *d;
+
+  if(parameters->energy == FALSE) return;
+
+  if(glob("/sys/class/powercap/intel-rapl:*", 0, NULL, &g) == 0){
+    for(i=0; i<g.gl_pathc && n_domains<MAX_DOMAINS; i++){
+      snprintf(file, sizeof(file), "%s/name", g.gl_pathv[i]);
+      fp = fopen(file, "r");
+      if(fp == NULL) continue;
+      if(fscanf(fp, "%63s", name) != 1) name[0] = '\0';
+      fclose(fp);
+      if(strncmp(name, "package", 7) != 0 && strcmp(name, "dram") != 0) continue;
+
+      d = &(domains[n_domains]);
+      d->dram = strcmp(name, "dram") == 0;
+      snprintf(file, sizeof(file), "%s/max_energy_range_uj", g.gl_pathv[i]);
+      if(read_counter(file, &(d->range)) == FALSE) continue;
+      snprintf(file, sizeof(file), "%s/energy_uj", g.gl_pathv[i]);
+      if(read_counter(file, &(d->last)) == FALSE) continue;
+      d->file = strdup(file);
+      n_domains++;
+    }
+    globfree(&g);
+  }
+
+  if(n_domains == 0){
+    printf("Energy counters aren't readable; energy isn't reported\n");
+    parameters->energy = FALSE;
+  }
+
+  return;
+}
+
+// Sets the package and DRAM energy in joules since init_energy(). Returns
+// FALSE, leaving them unset, if there are no counters.
+int read_energy(double *package, double *dram)
+{
+  int i;
+  unsigned long long v;
+  Rapl_Domain *d;
+
+  if(n_domains == 0) return FALSE;
+
+  for(i=0; i<n_domains; i++){
+    d = &(domains[i]);
+    if(read_counter(d->file, &v) == FALSE) continue;
+
+    // A counter below its last value has wrapped around once; the counters
+    // are read at every phase change, much more often than they can wrap
+    if(v >= d->last){
+      joules[d->dram] += (v - d->last)*1.0e-6;
+    }
+    else{
+      joules[d->dram] += (d->range - d->last + v)*1.0e-6;
+    }
+    d->last = v;
+  }
+  *package = joules[0];
+  *dram = joules[1];
+
+  return TRUE;
+}
+
+void free_energy(void)
+{
+  int i;
+
+  for(i=0; i<n_domains; i++){
+    free(domains[i].file);
+  }
+  n_domains = 0;
+
+  return;
+}
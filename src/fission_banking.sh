@@ -0,0 +1,21 @@
+#!/bin/bash
+# Runs a problem with analog and with implicit fission banking and reports the
+# change in the keff figure of merit. Arguments are passed to both runs, e.g.
+#   ./fission_banking.sh -particles 20000 -batches 80 -active 60 -bc vacuum
+
+make -s transport || exit 1
+
+# Keff mean and standard deviation of the last batch, and the keff FOM
+summary() {
+  ./transport "$@" > fission_banking.out || exit 1
+  awk '/^[0-9]+ / && NF >= 6 {mean=$4; std=$6} /^Keff FOM:/ {fom=$3}
+     END {print mean, std, fom}' fission_banking.out
+}
+
+read mean_a std_a fom_a < <(summary "$@" -fission_banking analog)
+read mean_i std_i fom_i < <(summary "$@" -fission_banking implicit)
+rm -f fission_banking.out
+
+echo "Analog:   keff $mean_a +/- $std_a  FOM $fom_a"
+echo "Implicit: keff $mean_i +/- $std_i  FOM $fom_i"
+awk "BEGIN {printf \"FOM ratio (implicit/analog): %.3f\n\", $fom_i/$fom_a}"
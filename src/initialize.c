@@ -2,6 +2,7 @@
 
 Parameters *init_parameters(void)
 {
+  int i;
   Parameters *p = malloc(sizeof(Parameters));
 
   p->n_particles = 1000000;
@@ -9,9 +10,22 @@ Parameters *init_parameters(void)
   p->n_generations = 1;
   p->n_active = 10;
   p->bc = REFLECT;
+  p->geometry = BOX;
+  p->population_control = RESERVOIR;
+  p->fission_banking = ANALOG;
+  p->symmetry = NO_SYMMETRY;
+  p->mode = EIGENVALUE;
+  p->solver = MONTE_CARLO;
+  p->ray_dead_length = 50;
+  p->ray_active_length = 500;
+  p->population_float = 0;
   p->n_nuclides = 1;
   p->tally = TRUE;
   p->n_bins = 16;
+  p->n_threads = 1;
+  p->pin_threads = TRUE;
+  p->huge_pages = HUGE_NONE;
+  p->simd = SIMD_AUTO;
   p->seed = 1;
   p->nu = 2.5;
   p->xs_f = 0.012;
@@ -20,8 +34,36 @@ Parameters *init_parameters(void)
   p->Lx = 400;
   p->Ly = 400;
   p->Lz = 400;
+  for(i=0; i<6; i++){
+    p->region[i] = 0;
+    p->source_region[i] = 0;
+  }
+  p->forced_collision = FALSE;
+  p->exp_transform = 0;
+  p->exp_direction[0] = 1;
+  p->exp_direction[1] = 0;
+  p->exp_direction[2] = 0;
+  p->weight_cutoff = 0.25;
+  p->point_detector = FALSE;
+  for(i=0; i<3; i++){
+    p->detector[i] = 0;
+  }
+  p->exclusion_radius = 0;
   p->load_source = FALSE;
   p->save_source = FALSE;
+  p->resume = FALSE;
+  p->shutdown_deadline = 50;
+  p->surface_write = NO_SURFACE;
+  p->surface_read = FALSE;
+  p->surface_reuse = 1;
+  p->cache_size = 1024;
+  p->cached_inactive = 5;
+  p->cached_source = FALSE;
+  p->cache_tolerance = 0.1;
+  p->depletion_steps = 0;
+  p->step_length = 30;
+  p->power = 1.0e6;
+  p->depletion_inactive = 5;
   p->write_tally = FALSE;
   p->write_entropy = FALSE;
   p->write_keff = FALSE;
@@ -32,6 +74,20 @@ Parameters *init_parameters(void)
   p->keff_file = NULL;
   p->bank_file = NULL;
   p->source_file = NULL;
+  p->mesh_file = NULL;
+  p->problem_file = NULL;
+  p->restart_file = NULL;
+  p->source_cache = NULL;
+  p->surface_file = NULL;
+  p->source_plugin = NULL;
+  p->source_plugin_args = NULL;
+  p->source_chunk = 4096;
+  p->profile = FALSE;
+  p->profile_rate = 1000;
+  p->cost_map = FALSE;
+  p->cost_file = NULL;
+  p->energy = FALSE;
+  p->benchmark_file = NULL;
 
   return p;
 }
@@ -40,73 +96,182 @@ Geometry *init_geometry(Parameters *parameters)
 {
   Geometry *g = malloc(sizeof(Geometry));
 
-  g->Lx = parameters->Lx;
-  g->Ly = parameters->Ly;
-  g->Lz = parameters->Lz;
+  g->type = parameters->geometry;
   g->bc = parameters->bc;
 
+  // The tet mesh replaces the box, with its bounding box as the domain
+  if(g->type == TET_MESH){
+    g->mesh = load_mesh(parameters->mesh_file);
+    g->Lx = g->mesh->L[0];
+    g->Ly = g->mesh->L[1];
+    g->Lz = g->mesh->L[2];
+    g->n_materials = g->mesh->n_materials;
+    if(parameters->point_detector == TRUE && locate_tet(g->mesh, parameters->detector) < 0)
+      print_error("The point detector must lie inside the mesh");
+  }
+  else{
+    g->mesh = NULL;
+    g->Lx = parameters->Lx;
+    g->Ly = parameters->Ly;
+    g->Lz = parameters->Lz;
+    g->n_materials = 1;
+  }
+
+  // An octant-symmetric box is modeled by its lower octant, with the symmetry
+  // planes through the center reflecting
+  g->symmetry = parameters->symmetry;
+  if(g->symmetry == OCTANT){
+    g->Lx /= 2;
+    g->Ly /= 2;
+    g->Lz /= 2;
+  }
+
+  // The region of interest defaults to the whole domain
+  memcpy(g->region, parameters->region, 6*sizeof(double));
+  if(g->region[1] <= g->region[0]){
+    g->region[0] = 0;
+    g->region[1] = g->Lx;
+    g->region[2] = 0;
+    g->region[3] = g->Ly;
+    g->region[4] = 0;
+    g->region[5] = g->Lz;
+  }
+
+  // A fixed source is sampled in the source region, also defaulting to the
+  // whole domain. In adjoint mode the two boxes swap roles: adjoint particles
+  // start from the detector response in the region of interest and score where
+  // the source is, so forced collisions and the region flux move to the source.
+  memcpy(g->source, parameters->source_region, 6*sizeof(double));
+  if(g->source[1] <= g->source[0]){
+    g->source[0] = 0;
+    g->source[1] = g->Lx;
+    g->source[2] = 0;
+    g->source[3] = g->Ly;
+    g->source[4] = 0;
+    g->source[5] = g->Lz;
+  }
+  if(parameters->mode == ADJOINT){
+    double box[6];
+    memcpy(box, g->source, 6*sizeof(double));
+    memcpy(g->source, g->region, 6*sizeof(double));
+    memcpy(g->region, box, 6*sizeof(double));
+  }
+
+  // An external source replaces the source box
+  g->plugin = NULL;
+  if(parameters->source_plugin != NULL){
+    g->plugin = load_source_plugin(parameters, g);
+  }
+
   return g;
 }
 
-Tally *init_tally(Parameters *parameters)
+Tally *init_tally(Parameters *parameters, Geometry *geometry)
 {
   Tally *t = malloc(sizeof(Tally));
 
   t->tallies_on = FALSE;
   t->n = parameters->n_bins;
-  t->dx = parameters->Lx/t->n;
-  t->dy = parameters->Ly/t->n;
-  t->dz = parameters->Lz/t->n;
-  t->flux = calloc(t->n*t->n*t->n, sizeof(double));
+  t->symmetry = geometry->symmetry;
+  if(t->symmetry == OCTANT){
+    t->n /= 2;
+  }
+  t->dx = geometry->Lx/t->n;
+  t->dy = geometry->Ly/t->n;
+  t->dz = geometry->Lz/t->n;
+
+  // On a tet mesh the tally bins are the mesh elements
+  if(geometry->type == TET_MESH){
+    t->sz = geometry->mesh->n_tets;
+    t->volume = geometry->mesh->volume;
+  }
+  else{
+    t->sz = (unsigned long)t->n*t->n*t->n;
+    t->volume = NULL;
+  }
+  t->flux = huge_calloc(t->sz, sizeof(double));
+  t->region = geometry->region;
+  t->region_flux = 0;
+  t->region_batch = calloc(parameters->n_active, sizeof(double));
+  t->detector = parameters->detector;
+  t->point_flux = 0;
+  t->point_batch = calloc(parameters->n_active, sizeof(double));
+  t->surface = NULL;
+  if(parameters->surface_write != NO_SURFACE){
+    t->surface = init_bank(1024);
+  }
+  t->n_materials = geometry->n_materials;
+  t->cell_material = geometry->type == TET_MESH ? geometry->mesh->material : NULL;
+  t->material_flux = NULL;
+  if(parameters->depletion_steps > 0){
+    t->material_flux = calloc(t->n_materials, sizeof(double));
+  }
+  t->cost = NULL;
+  if(parameters->cost_map == TRUE){
+    t->cost = calloc(N_COSTS*t->sz, sizeof(double));
+  }
 
   return t;
 }
 
-Material *init_material(Parameters *parameters)
+Material *init_material(Parameters *parameters, Geometry *geometry)
 {
-  int i;
-  Nuclide sum = {0, 0, 0, 0, 0};
-
-  // Hardwire the material macroscopic cross sections for now to produce a keff
-  // close to 1 (fission, absorption, scattering, total, atomic density)
-  Nuclide macro = {parameters->xs_f, parameters->xs_a, parameters->xs_s,
-     parameters->xs_f + parameters->xs_a + parameters->xs_s, 1.0};
-
-  Material *m = malloc(sizeof(Material));
-  m->n_nuclides = parameters->n_nuclides;
-  m->nuclides = malloc(m->n_nuclides*sizeof(Nuclide));
-
-  // Generate some arbitrary microscopic cross section values and atomic
-  // densities for each nuclide in the material such that the total macroscopic
-  // cross sections evaluate to what is hardwired above
-  for(i=0; i<m->n_nuclides; i++){
-    if(i<m->n_nuclides-1){
-      m->nuclides[i].atom_density = rn()*macro.atom_density;
-      macro.atom_density -= m->nuclides[i].atom_density;
+  int i, k;
+  Material *materials = malloc(geometry->n_materials*sizeof(Material));
+  Material *m;
+
+  for(k=0; k<geometry->n_materials; k++){
+    Nuclide sum = {0, 0, 0, 0, 0};
+    Nuclide macro = {parameters->xs_f, parameters->xs_a, parameters->xs_s,
+       parameters->xs_f + parameters->xs_a + parameters->xs_s, 1.0};
+
+    // Materials of a tet mesh take their macroscopic cross sections from the
+    // mesh file; otherwise hardwire the material macroscopic cross sections
+    // for now to produce a keff close to 1 (fission, absorption, scattering,
+    // total, atomic density)
+    if(geometry->type == TET_MESH){
+      macro.xs_f = geometry->mesh->xs[3*k];
+      macro.xs_a = geometry->mesh->xs[3*k+1];
+      macro.xs_s = geometry->mesh->xs[3*k+2];
+      macro.xs_t = macro.xs_f + macro.xs_a + macro.xs_s;
+    }
+
+    m = &(materials[k]);
+    m->n_nuclides = parameters->n_nuclides;
+    m->nuclides = malloc(m->n_nuclides*sizeof(Nuclide));
+
+    // Generate some arbitrary microscopic cross section values and atomic
+    // densities for each nuclide in the material such that the total
+    // macroscopic cross sections evaluate to what is hardwired above
+    for(i=0; i<m->n_nuclides; i++){
+      if(i<m->n_nuclides-1){
+        m->nuclides[i].atom_density = rn()*macro.atom_density;
+        macro.atom_density -= m->nuclides[i].atom_density;
+      }
+      else{
+        m->nuclides[i].atom_density = macro.atom_density;
+      }
+      m->nuclides[i].xs_a = rn();
+      sum.xs_a += m->nuclides[i].xs_a * m->nuclides[i].atom_density;
+      m->nuclides[i].xs_f = rn();
+      sum.xs_f += m->nuclides[i].xs_f * m->nuclides[i].atom_density;
+      m->nuclides[i].xs_s = rn();
+      sum.xs_s += m->nuclides[i].xs_s * m->nuclides[i].atom_density;
     }
-    else{
-      m->nuclides[i].atom_density = macro.atom_density;
+    for(i=0; i<m->n_nuclides; i++){
+      m->nuclides[i].xs_a = macro.xs_a > 0 ? m->nuclides[i].xs_a/(sum.xs_a/macro.xs_a) : 0;
+      m->nuclides[i].xs_f = macro.xs_f > 0 ? m->nuclides[i].xs_f/(sum.xs_f/macro.xs_f) : 0;
+      m->nuclides[i].xs_s = macro.xs_s > 0 ? m->nuclides[i].xs_s/(sum.xs_s/macro.xs_s) : 0;
+      m->nuclides[i].xs_t = m->nuclides[i].xs_a + m->nuclides[i].xs_s;
     }
-    m->nuclides[i].xs_a = rn();
-    sum.xs_a += m->nuclides[i].xs_a * m->nuclides[i].atom_density;
-    m->nuclides[i].xs_f = rn();
-    sum.xs_f += m->nuclides[i].xs_f * m->nuclides[i].atom_density;
-    m->nuclides[i].xs_s = rn();
-    sum.xs_s += m->nuclides[i].xs_s * m->nuclides[i].atom_density;
-  }
-  for(i=0; i<m->n_nuclides; i++){
-    m->nuclides[i].xs_a /= sum.xs_a/macro.xs_a;
-    m->nuclides[i].xs_f /= sum.xs_f/macro.xs_f;
-    m->nuclides[i].xs_s /= sum.xs_s/macro.xs_s;
-    m->nuclides[i].xs_t = m->nuclides[i].xs_a + m->nuclides[i].xs_s;
-  }
-
-  m->xs_f = parameters->xs_f;
-  m->xs_a = parameters->xs_a;
-  m->xs_s = parameters->xs_s;
-  m->xs_t = parameters->xs_a + parameters->xs_s;
-
-  return m;
+
+    m->xs_f = macro.xs_f;
+    m->xs_a = macro.xs_a;
+    m->xs_s = macro.xs_s;
+    m->xs_t = macro.xs_a + macro.xs_s;
+  }
+
+  return materials;
 }
 
 Bank *init_source_bank(Parameters *parameters, Geometry *geometry)
@@ -117,11 +282,35 @@ Bank *init_source_bank(Parameters *parameters, Geometry *geometry)
   // Initialize source bank
   source_bank = init_bank(parameters->n_particles);
 
-  // Sample source particles or load a source
+  // A fixed source is sampled at the start of each batch, and random rays
+  // need no source bank
+  if(parameters->mode != EIGENVALUE || parameters->solver == RANDOM_RAY){
+    return source_bank;
+  }
+
+  // A resumed run keeps the batches of the run it resumes, which a cached
+  // source may have cut
+  if(parameters->resume == TRUE){
+    resume_batches(parameters);
+  }
+
+  // Sample source particles, load a source, or start from a converged source
+  // of a run of a similar problem, which needs fewer inactive batches
   if(parameters->load_source == TRUE){
     load_source(source_bank);
     source_bank->n = parameters->n_particles;
   }
+  else if(parameters->source_cache != NULL && parameters->resume == FALSE &&
+     load_cached_source(parameters, geometry, source_bank) == TRUE){
+    parameters->cached_source = TRUE;
+    if(parameters->n_batches - parameters->n_active > parameters->cached_inactive){
+      parameters->n_batches = parameters->n_active + parameters->cached_inactive;
+      printf("Reduced number of batches to %d\n", parameters->n_batches);
+    }
+  }
+  else if(geometry->plugin != NULL){
+    sample_plugin_source(geometry->plugin, geometry, 0, parameters->n_particles, source_bank);
+  }
   else{
     for(i_p=0; i_p<parameters->n_particles; i_p++){
       sample_source_particle(geometry, &(source_bank->p[i_p]));
@@ -143,7 +332,7 @@ Bank *init_fission_bank(Parameters *parameters)
 Bank *init_bank(unsigned long n_particles)
 {
   Bank *b = malloc(sizeof(Bank));
-  b->p = malloc(n_particles*sizeof(Particle));
+  b->p = huge_malloc(n_particles*sizeof(Particle));
   b->sz = n_particles;
   b->n = 0;
   b->resize = resize_particles;
@@ -153,24 +342,65 @@ Bank *init_bank(unsigned long n_particles)
 
 void sample_source_particle(Geometry *geometry, Particle *p)
 {
+  double mu = rn()*2 - 1; // cosine of polar angle
+  double phi = rn()*2*PI; // azimuthal angle
+
   p->alive = TRUE;
-  p->energy = 1;
-  p->last_energy = 1;
-  p->mu = rn()*2 - 1;
-  p->phi = rn()*2*PI;
-  p->u = p->mu;
-  p->v = sqrt(1 - p->mu*p->mu)*cos(p->phi);
-  p->w = sqrt(1 - p->mu*p->mu)*sin(p->phi);
+  p->u = mu;
+  p->v = sqrt(1 - mu*mu)*cos(phi);
+  p->w = sqrt(1 - mu*mu)*sin(phi);
   p->x = rn()*geometry->Lx;
   p->y = rn()*geometry->Ly;
   p->z = rn()*geometry->Lz;
+  p->weight = 1;
+  p->force = TRUE;
+
+  // Locate the particle in the tet mesh, resampling points that fall in the
+  // bounding box but outside the mesh
+  if(geometry->type == TET_MESH){
+    double x[3] = {p->x, p->y, p->z};
+    while((p->cell = locate_tet(geometry->mesh, x)) < 0){
+      x[0] = p->x = rn()*geometry->Lx;
+      x[1] = p->y = rn()*geometry->Ly;
+      x[2] = p->z = rn()*geometry->Lz;
+    }
+  }
+
+  return;
+}
+
+// Samples a particle uniformly in a box and isotropically in direction. On a
+// tet mesh points outside the mesh are resampled.
+void sample_box_particle(Geometry *geometry, double *box, Particle *p)
+{
+  double mu = rn()*2 - 1; // cosine of polar angle
+  double phi = rn()*2*PI; // azimuthal angle
+
+  p->alive = TRUE;
+  p->u = mu;
+  p->v = sqrt(1 - mu*mu)*cos(phi);
+  p->w = sqrt(1 - mu*mu)*sin(phi);
+  p->x = box[0] + rn()*(box[1] - box[0]);
+  p->y = box[2] + rn()*(box[3] - box[2]);
+  p->z = box[4] + rn()*(box[5] - box[4]);
+  p->weight = 1;
+  p->force = TRUE;
+
+  if(geometry->type == TET_MESH){
+    double x[3] = {p->x, p->y, p->z};
+    while((p->cell = locate_tet(geometry->mesh, x)) < 0){
+      x[0] = p->x = box[0] + rn()*(box[1] - box[0]);
+      x[1] = p->y = box[2] + rn()*(box[3] - box[2]);
+      x[2] = p->z = box[4] + rn()*(box[5] - box[4]);
+    }
+  }
 
   return;
 }
 
 void resize_particles(Bank *b)
 {
-  b->p = realloc(b->p, sizeof(Particle)*2*b->sz);
+  b->p = huge_realloc(b->p, sizeof(Particle)*b->sz, sizeof(Particle)*2*b->sz);
   b->sz = 2*b->sz;
 
   return;
@@ -178,7 +408,7 @@ void resize_particles(Bank *b)
 
 void free_bank(Bank *b)
 {
-  free(b->p);
+  huge_free(b->p);
   b->p = NULL;
   free(b);
   b = NULL;
@@ -186,10 +416,28 @@ void free_bank(Bank *b)
   return;
 }
 
-void free_material(Material *m)
+void free_geometry(Geometry *g)
+{
+  if(g->mesh != NULL){
+    free_mesh(g->mesh);
+  }
+  if(g->plugin != NULL){
+    free_source_plugin(g->plugin);
+  }
+  free(g);
+  g = NULL;
+
+  return;
+}
+
+void free_material(Material *m, int n_materials)
 {
-  free(m->nuclides);
-  m->nuclides = NULL;
+  int i;
+
+  for(i=0; i<n_materials; i++){
+    free(m[i].nuclides);
+    m[i].nuclides = NULL;
+  }
   free(m);
   m = NULL;
 
@@ -198,8 +446,19 @@ void free_material(Material *m)
 
 void free_tally(Tally *t)
 {
-  free(t->flux);
+  huge_free(t->flux);
   t->flux = NULL;
+  free(t->region_batch);
+  t->region_batch = NULL;
+  free(t->point_batch);
+  t->point_batch = NULL;
+  free(t->material_flux);
+  t->material_flux = NULL;
+  free(t->cost);
+  t->cost = NULL;
+  if(t->surface != NULL){
+    free_bank(t->surface);
+  }
   free(t);
   t = NULL;
 
@@ -1,5 +1,41 @@
 #include "simple_mc.h"
 
+// Reads a list of n comma separated values
+static void read_list(char *s, double *x, int n, char *message)
+{
+  int i;
+  char *end;
+
+  for(i=0; i<n; i++){
+    x[i] = strtod(s, &end);
+    if(end == s) print_error(message);
+    s = end;
+    if(i < n-1){
+      if(*s != ',') print_error(message);
+      s++;
+    }
+  }
+
+  return;
+}
+
+// Reads the surface a surface source is written from
+static int read_surface(char *s)
+{
+  int i;
+  char *names[6] = {"x0", "x1", "y0", "y1", "z0", "z1"};
+  int surfaces[6] = {X0, X1, Y0, Y1, Z0, Z1};
+
+  for(i=0; i<6; i++){
+    if(strcasecmp(s, names[i]) == 0) return surfaces[i];
+  }
+  if(strcasecmp(s, "all") == 0) return ALL_SURFACES;
+  if(strcasecmp(s, "none") == 0) return NO_SURFACE;
+  print_error("Invalid option for parameter 'surface_write': must be 'none', 'all', 'x0', 'x1', 'y0', 'y1', 'z0' or 'z1'");
+
+  return NO_SURFACE;
+}
+
 // Read in parameters from file
 void parse_parameters(Parameters *parameters)
 {
@@ -57,6 +93,50 @@ void parse_parameters(Parameters *parameters)
       parameters->n_bins = atoi(strtok(NULL, "=\n"));
     }
 
+    // Number of threads
+    else if(strcmp(s, "threads") == 0){
+      parameters->n_threads = atoi(strtok(NULL, "=\n"));
+    }
+
+    // Whether to pin threads to cores
+    else if(strcmp(s, "pin_threads") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "true") == 0)
+        parameters->pin_threads = TRUE;
+      else if(strcasecmp(s, "false") == 0)
+        parameters->pin_threads = FALSE;
+      else
+        print_error("Invalid option for parameter 'pin_threads': must be 'true' or 'false'");
+    }
+
+    // Huge page backing of banks and tallies
+    else if(strcmp(s, "huge_pages") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "none") == 0)
+        parameters->huge_pages = HUGE_NONE;
+      else if(strcasecmp(s, "thp") == 0)
+        parameters->huge_pages = HUGE_THP;
+      else if(strcasecmp(s, "hugetlbfs") == 0)
+        parameters->huge_pages = HUGE_HUGETLBFS;
+      else
+        print_error("Invalid option for parameter 'huge_pages': must be 'none', 'thp' or 'hugetlbfs'");
+    }
+
+    // SIMD variant of the kernels
+    else if(strcmp(s, "simd") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "auto") == 0)
+        parameters->simd = SIMD_AUTO;
+      else if(strcasecmp(s, "scalar") == 0)
+        parameters->simd = SIMD_SCALAR;
+      else if(strcasecmp(s, "avx2") == 0)
+        parameters->simd = SIMD_AVX2;
+      else if(strcasecmp(s, "avx512") == 0)
+        parameters->simd = SIMD_AVX512;
+      else
+        print_error("Invalid option for parameter 'simd': must be 'auto', 'scalar', 'avx2' or 'avx512'");
+    }
+
     // RNG seed
     else if(strcmp(s, "seed") == 0){
       parameters->seed = atol(strtok(NULL, "=\n"));
@@ -97,6 +177,57 @@ void parse_parameters(Parameters *parameters)
       parameters->Lz = atof(strtok(NULL, "=\n"));
     }
 
+    // Region of interest
+    else if(strcmp(s, "region") == 0){
+      read_list(strtok(NULL, "=\n"), parameters->region, 6,
+         "Invalid option for parameter 'region': must be 'x0,x1,y0,y1,z0,z1'");
+    }
+
+    // Box the fixed source is sampled in
+    else if(strcmp(s, "source_region") == 0){
+      read_list(strtok(NULL, "=\n"), parameters->source_region, 6,
+         "Invalid option for parameter 'source_region': must be 'x0,x1,y0,y1,z0,z1'");
+    }
+
+    // Whether to force collisions in the region
+    else if(strcmp(s, "forced_collision") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "true") == 0)
+        parameters->forced_collision = TRUE;
+      else if(strcasecmp(s, "false") == 0)
+        parameters->forced_collision = FALSE;
+      else
+        print_error("Invalid option for parameter 'forced_collision': must be 'true' or 'false'");
+    }
+
+    // Exponential transform stretching parameter
+    else if(strcmp(s, "exp_transform") == 0){
+      parameters->exp_transform = atof(strtok(NULL, "=\n"));
+    }
+
+    // Preferred direction of the exponential transform
+    else if(strcmp(s, "exp_direction") == 0){
+      read_list(strtok(NULL, "=\n"), parameters->exp_direction, 3,
+         "Invalid option for parameter 'exp_direction': must be 'u,v,w'");
+    }
+
+    // Weight cutoff for Russian roulette
+    else if(strcmp(s, "weight_cutoff") == 0){
+      parameters->weight_cutoff = atof(strtok(NULL, "=\n"));
+    }
+
+    // Position of the point detector
+    else if(strcmp(s, "detector") == 0){
+      read_list(strtok(NULL, "=\n"), parameters->detector, 3,
+         "Invalid option for parameter 'detector': must be 'x,y,z'");
+      parameters->point_detector = TRUE;
+    }
+
+    // Radius around the point detector within which the flux is averaged
+    else if(strcmp(s, "exclusion_radius") == 0){
+      parameters->exclusion_radius = atof(strtok(NULL, "=\n"));
+    }
+
     // Boundary conditions
     else if(strcmp(s, "bc") == 0){
       s = strtok(NULL, "=\n");
@@ -110,6 +241,96 @@ void parse_parameters(Parameters *parameters)
         print_error("Invalid boundary condition");
     }
 
+    // Population control method
+    else if(strcmp(s, "population_control") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "reservoir") == 0)
+        parameters->population_control = RESERVOIR;
+      else if(strcasecmp(s, "comb") == 0)
+        parameters->population_control = COMB;
+      else
+        print_error("Invalid option for parameter 'population_control': must be 'reservoir' or 'comb'");
+    }
+
+    // Symmetry of the domain
+    else if(strcmp(s, "symmetry") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "none") == 0)
+        parameters->symmetry = NO_SYMMETRY;
+      else if(strcasecmp(s, "octant") == 0)
+        parameters->symmetry = OCTANT;
+      else
+        print_error("Invalid option for parameter 'symmetry': must be 'none' or 'octant'");
+    }
+
+    // Run mode
+    else if(strcmp(s, "mode") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "eigenvalue") == 0)
+        parameters->mode = EIGENVALUE;
+      else if(strcasecmp(s, "forward") == 0)
+        parameters->mode = FORWARD;
+      else if(strcasecmp(s, "adjoint") == 0)
+        parameters->mode = ADJOINT;
+      else
+        print_error("Invalid option for parameter 'mode': must be 'eigenvalue', 'forward' or 'adjoint'");
+    }
+
+    // Eigenvalue solver
+    else if(strcmp(s, "solver") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "monte_carlo") == 0)
+        parameters->solver = MONTE_CARLO;
+      else if(strcasecmp(s, "random_ray") == 0)
+        parameters->solver = RANDOM_RAY;
+      else
+        print_error("Invalid option for parameter 'solver': must be 'monte_carlo' or 'random_ray'");
+    }
+
+    // Distance a random ray travels before it scores
+    else if(strcmp(s, "ray_dead_length") == 0){
+      parameters->ray_dead_length = atof(strtok(NULL, "=\n"));
+    }
+
+    // Distance a random ray scores over
+    else if(strcmp(s, "ray_active_length") == 0){
+      parameters->ray_active_length = atof(strtok(NULL, "=\n"));
+    }
+
+    // Fission banking method
+    else if(strcmp(s, "fission_banking") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "analog") == 0)
+        parameters->fission_banking = ANALOG;
+      else if(strcasecmp(s, "implicit") == 0)
+        parameters->fission_banking = IMPLICIT;
+      else
+        print_error("Invalid option for parameter 'fission_banking': must be 'analog' or 'implicit'");
+    }
+
+    // Fraction the population may float by
+    else if(strcmp(s, "population_float") == 0){
+      parameters->population_float = atof(strtok(NULL, "=\n"));
+    }
+
+    // Geometry type
+    else if(strcmp(s, "geometry") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "box") == 0)
+        parameters->geometry = BOX;
+      else if(strcasecmp(s, "mesh") == 0)
+        parameters->geometry = TET_MESH;
+      else
+        print_error("Invalid option for parameter 'geometry': must be 'box' or 'mesh'");
+    }
+
+    // Path to read tetrahedral mesh from
+    else if(strcmp(s, "mesh_file") == 0){
+      s = strtok(NULL, "=\n");
+      parameters->mesh_file = malloc(strlen(s)*sizeof(char)+1);
+      strcpy(parameters->mesh_file, s);
+    }
+
     // Whether to load source
     else if(strcmp(s, "load_source") == 0){
       s = strtok(NULL, "=\n");
@@ -132,6 +353,170 @@ void parse_parameters(Parameters *parameters)
         print_error("Invalid option for parameter 'save_source': must be 'true' or 'false'");
     }
 
+    // Whether to resume from the restart file
+    else if(strcmp(s, "resume") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "true") == 0)
+        parameters->resume = TRUE;
+      else if(strcasecmp(s, "false") == 0)
+        parameters->resume = FALSE;
+      else
+        print_error("Invalid option for parameter 'resume': must be 'true' or 'false'");
+    }
+
+    // Seconds after SIGTERM by which the restart file is written
+    else if(strcmp(s, "shutdown_deadline") == 0){
+      parameters->shutdown_deadline = atof(strtok(NULL, "=\n"));
+    }
+
+    // Path to write the restart file to and resume from
+    else if(strcmp(s, "restart_file") == 0){
+      s = strtok(NULL, "=\n");
+      parameters->restart_file = malloc(strlen(s)*sizeof(char)+1);
+      strcpy(parameters->restart_file, s);
+    }
+
+    // Surface whose crossings are written to the surface source file
+    else if(strcmp(s, "surface_write") == 0){
+      parameters->surface_write = read_surface(strtok(NULL, "=\n"));
+    }
+
+    // Whether a fixed source is sampled from the surface source file
+    else if(strcmp(s, "surface_read") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "true") == 0)
+        parameters->surface_read = TRUE;
+      else if(strcasecmp(s, "false") == 0)
+        parameters->surface_read = FALSE;
+      else
+        print_error("Invalid option for parameter 'surface_read': must be 'true' or 'false'");
+    }
+
+    // Number of times each surface source site is used
+    else if(strcmp(s, "surface_reuse") == 0){
+      parameters->surface_reuse = atoi(strtok(NULL, "=\n"));
+    }
+
+    // Path to write the surface source to and read it from
+    else if(strcmp(s, "surface_file") == 0){
+      s = strtok(NULL, "=\n");
+      parameters->surface_file = malloc(strlen(s)*sizeof(char)+1);
+      strcpy(parameters->surface_file, s);
+    }
+
+    // Shared object that samples the source
+    else if(strcmp(s, "source_plugin") == 0){
+      s = strtok(NULL, "=\n");
+      parameters->source_plugin = malloc(strlen(s)*sizeof(char)+1);
+      strcpy(parameters->source_plugin, s);
+    }
+
+    // Argument string passed to the source plugin
+    else if(strcmp(s, "source_plugin_args") == 0){
+      s = strtok(NULL, "=\n");
+      parameters->source_plugin_args = malloc(strlen(s)*sizeof(char)+1);
+      strcpy(parameters->source_plugin_args, s);
+    }
+
+    // Number of sites the source plugin samples per call
+    else if(strcmp(s, "source_chunk") == 0){
+      parameters->source_chunk = atol(strtok(NULL, "=\n"));
+    }
+
+    // Whether to sample where the run spends its time
+    else if(strcmp(s, "profile") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "true") == 0)
+        parameters->profile = TRUE;
+      else if(strcasecmp(s, "false") == 0)
+        parameters->profile = FALSE;
+      else
+        print_error("Invalid option for parameter 'profile': must be 'true' or 'false'");
+    }
+
+    // Profiler samples per second of cpu time on each thread
+    else if(strcmp(s, "profile_rate") == 0){
+      parameters->profile_rate = atof(strtok(NULL, "=\n"));
+    }
+
+    // Whether to map the events and time spent in each tally bin
+    else if(strcmp(s, "cost_map") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "true") == 0)
+        parameters->cost_map = TRUE;
+      else if(strcasecmp(s, "false") == 0)
+        parameters->cost_map = FALSE;
+      else
+        print_error("Invalid option for parameter 'cost_map': must be 'true' or 'false'");
+    }
+
+    // Path to write the cost map to
+    else if(strcmp(s, "cost_file") == 0){
+      s = strtok(NULL, "=\n");
+      parameters->cost_file = malloc(strlen(s)*sizeof(char)+1);
+      strcpy(parameters->cost_file, s);
+    }
+
+    // Whether to read the RAPL energy counters
+    else if(strcmp(s, "energy") == 0){
+      s = strtok(NULL, "=\n");
+      if(strcasecmp(s, "true") == 0)
+        parameters->energy = TRUE;
+      else if(strcasecmp(s, "false") == 0)
+        parameters->energy = FALSE;
+      else
+        print_error("Invalid option for parameter 'energy': must be 'true' or 'false'");
+    }
+
+    // Path to write the run's metrics to as JSON
+    else if(strcmp(s, "benchmark_file") == 0){
+      s = strtok(NULL, "=\n");
+      parameters->benchmark_file = malloc(strlen(s)*sizeof(char)+1);
+      strcpy(parameters->benchmark_file, s);
+    }
+
+    // Directory of converged sources shared between runs
+    else if(strcmp(s, "source_cache") == 0){
+      s = strtok(NULL, "=\n");
+      parameters->source_cache = malloc(strlen(s)*sizeof(char)+1);
+      strcpy(parameters->source_cache, s);
+    }
+
+    // MB the source cache may grow to
+    else if(strcmp(s, "cache_size") == 0){
+      parameters->cache_size = atof(strtok(NULL, "=\n"));
+    }
+
+    // Number of inactive batches when starting from a cached source
+    else if(strcmp(s, "cached_inactive") == 0){
+      parameters->cached_inactive = atoi(strtok(NULL, "=\n"));
+    }
+
+    // Largest relative parameter difference to use a cached source
+    else if(strcmp(s, "cache_tolerance") == 0){
+      parameters->cache_tolerance = atof(strtok(NULL, "=\n"));
+    }
+
+    // Number of burnup steps
+    else if(strcmp(s, "depletion_steps") == 0){
+      parameters->depletion_steps = atoi(strtok(NULL, "=\n"));
+    }
+
+    // Length of each burnup step in days
+    else if(strcmp(s, "step_length") == 0){
+      parameters->step_length = atof(strtok(NULL, "=\n"));
+    }
+
+    // Power the flux is normalized to when depleting
+    else if(strcmp(s, "power") == 0){
+      parameters->power = atof(strtok(NULL, "=\n"));
+    }
+
+    // Number of inactive batches of each burnup step after the first
+    else if(strcmp(s, "depletion_inactive") == 0){
+      parameters->depletion_inactive = atoi(strtok(NULL, "=\n"));
+    }
+
     // Whether to output tally
     else if(strcmp(s, "write_tally") == 0){
       s = strtok(NULL, "=\n");
@@ -269,6 +654,66 @@ void read_CLI(int argc, char *argv[], Parameters *parameters)
       else print_error("Error reading command line input '-generations'");
     }
 
+    // Region of interest (-region)
+    else if(strcmp(arg, "-region") == 0){
+      if(++i < argc) read_list(argv[i], parameters->region, 6,
+         "Invalid option for parameter 'region': must be 'x0,x1,y0,y1,z0,z1'");
+      else print_error("Error reading command line input '-region'");
+    }
+
+    // Box the fixed source is sampled in (-source_region)
+    else if(strcmp(arg, "-source_region") == 0){
+      if(++i < argc) read_list(argv[i], parameters->source_region, 6,
+         "Invalid option for parameter 'source_region': must be 'x0,x1,y0,y1,z0,z1'");
+      else print_error("Error reading command line input '-source_region'");
+    }
+
+    // Whether to force collisions in the region (-forced_collision)
+    else if(strcmp(arg, "-forced_collision") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "true") == 0)
+          parameters->forced_collision = TRUE;
+        else if(strcasecmp(argv[i], "false") == 0)
+          parameters->forced_collision = FALSE;
+        else
+          print_error("Invalid option for parameter 'forced_collision': must be 'true' or 'false'");
+      }
+      else print_error("Error reading command line input '-forced_collision'");
+    }
+
+    // Exponential transform stretching parameter (-exp_transform)
+    else if(strcmp(arg, "-exp_transform") == 0){
+      if(++i < argc) parameters->exp_transform = atof(argv[i]);
+      else print_error("Error reading command line input '-exp_transform'");
+    }
+
+    // Position of the point detector (-detector)
+    else if(strcmp(arg, "-detector") == 0){
+      if(++i < argc) read_list(argv[i], parameters->detector, 3,
+         "Invalid option for parameter 'detector': must be 'x,y,z'");
+      else print_error("Error reading command line input '-detector'");
+      parameters->point_detector = TRUE;
+    }
+
+    // Radius around the point detector within which the flux is averaged (-exclusion_radius)
+    else if(strcmp(arg, "-exclusion_radius") == 0){
+      if(++i < argc) parameters->exclusion_radius = atof(argv[i]);
+      else print_error("Error reading command line input '-exclusion_radius'");
+    }
+
+    // Preferred direction of the exponential transform (-exp_direction)
+    else if(strcmp(arg, "-exp_direction") == 0){
+      if(++i < argc) read_list(argv[i], parameters->exp_direction, 3,
+         "Invalid option for parameter 'exp_direction': must be 'u,v,w'");
+      else print_error("Error reading command line input '-exp_direction'");
+    }
+
+    // Weight cutoff for Russian roulette (-weight_cutoff)
+    else if(strcmp(arg, "-weight_cutoff") == 0){
+      if(++i < argc) parameters->weight_cutoff = atof(argv[i]);
+      else print_error("Error reading command line input '-weight_cutoff'");
+    }
+
     // Boundary conditions (-bc)
     else if(strcmp(arg, "-bc") == 0){
       if(++i < argc){
@@ -284,6 +729,124 @@ void read_CLI(int argc, char *argv[], Parameters *parameters)
       else print_error("Error reading command line input '-bc'");
     }
 
+    // Population control method (-population_control)
+    else if(strcmp(arg, "-population_control") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "reservoir") == 0)
+          parameters->population_control = RESERVOIR;
+        else if(strcasecmp(argv[i], "comb") == 0)
+          parameters->population_control = COMB;
+        else
+          print_error("Invalid option for parameter 'population_control': must be 'reservoir' or 'comb'");
+      }
+      else print_error("Error reading command line input '-population_control'");
+    }
+
+    // Symmetry of the domain (-symmetry)
+    else if(strcmp(arg, "-symmetry") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "none") == 0)
+          parameters->symmetry = NO_SYMMETRY;
+        else if(strcasecmp(argv[i], "octant") == 0)
+          parameters->symmetry = OCTANT;
+        else
+          print_error("Invalid option for parameter 'symmetry': must be 'none' or 'octant'");
+      }
+      else print_error("Error reading command line input '-symmetry'");
+    }
+
+    // Run mode (-mode)
+    else if(strcmp(arg, "-mode") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "eigenvalue") == 0)
+          parameters->mode = EIGENVALUE;
+        else if(strcasecmp(argv[i], "forward") == 0)
+          parameters->mode = FORWARD;
+        else if(strcasecmp(argv[i], "adjoint") == 0)
+          parameters->mode = ADJOINT;
+        else
+          print_error("Invalid option for parameter 'mode': must be 'eigenvalue', 'forward' or 'adjoint'");
+      }
+      else print_error("Error reading command line input '-mode'");
+    }
+
+    // Eigenvalue solver (-solver)
+    else if(strcmp(arg, "-solver") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "monte_carlo") == 0)
+          parameters->solver = MONTE_CARLO;
+        else if(strcasecmp(argv[i], "random_ray") == 0)
+          parameters->solver = RANDOM_RAY;
+        else
+          print_error("Invalid option for parameter 'solver': must be 'monte_carlo' or 'random_ray'");
+      }
+      else print_error("Error reading command line input '-solver'");
+    }
+
+    // Distance a random ray travels before it scores (-ray_dead_length)
+    else if(strcmp(arg, "-ray_dead_length") == 0){
+      if(++i < argc) parameters->ray_dead_length = atof(argv[i]);
+      else print_error("Error reading command line input '-ray_dead_length'");
+    }
+
+    // Distance a random ray scores over (-ray_active_length)
+    else if(strcmp(arg, "-ray_active_length") == 0){
+      if(++i < argc) parameters->ray_active_length = atof(argv[i]);
+      else print_error("Error reading command line input '-ray_active_length'");
+    }
+
+    // Fission banking method (-fission_banking)
+    else if(strcmp(arg, "-fission_banking") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "analog") == 0)
+          parameters->fission_banking = ANALOG;
+        else if(strcasecmp(argv[i], "implicit") == 0)
+          parameters->fission_banking = IMPLICIT;
+        else
+          print_error("Invalid option for parameter 'fission_banking': must be 'analog' or 'implicit'");
+      }
+      else print_error("Error reading command line input '-fission_banking'");
+    }
+
+    // Fraction the population may float by (-population_float)
+    else if(strcmp(arg, "-population_float") == 0){
+      if(++i < argc) parameters->population_float = atof(argv[i]);
+      else print_error("Error reading command line input '-population_float'");
+    }
+
+    // Geometry type (-geometry)
+    else if(strcmp(arg, "-geometry") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "box") == 0)
+          parameters->geometry = BOX;
+        else if(strcasecmp(argv[i], "mesh") == 0)
+          parameters->geometry = TET_MESH;
+        else
+          print_error("Invalid option for parameter 'geometry': must be 'box' or 'mesh'");
+      }
+      else print_error("Error reading command line input '-geometry'");
+    }
+
+    // Path to read tetrahedral mesh from (-mesh_file)
+    else if(strcmp(arg, "-mesh_file") == 0){
+      if(++i < argc){
+        if(parameters->mesh_file != NULL) free(parameters->mesh_file);
+        parameters->mesh_file = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->mesh_file, argv[i]);
+      }
+      else print_error("Error reading command line input '-mesh_file'");
+    }
+
+    // Write the header of a problem-specialized build and exit (-specialize)
+    else if(strcmp(arg, "-specialize") == 0){
+      if(++i < argc){
+        if(parameters->problem_file != NULL) free(parameters->problem_file);
+        parameters->problem_file = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->problem_file, argv[i]);
+      }
+      else print_error("Error reading command line input '-specialize'");
+    }
+
     // Number of nuclides in material (-nuclides)
     else if(strcmp(arg, "-nuclides") == 0){
       if(++i < argc) parameters->n_nuclides = atoi(argv[i]);
@@ -309,6 +872,57 @@ void read_CLI(int argc, char *argv[], Parameters *parameters)
       else print_error("Error reading command line input '-bins'");
     }
 
+    // Number of threads (-threads)
+    else if(strcmp(arg, "-threads") == 0){
+      if(++i < argc) parameters->n_threads = atoi(argv[i]);
+      else print_error("Error reading command line input '-threads'");
+    }
+
+    // Whether to pin threads to cores (-pin_threads)
+    else if(strcmp(arg, "-pin_threads") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "true") == 0)
+          parameters->pin_threads = TRUE;
+        else if(strcasecmp(argv[i], "false") == 0)
+          parameters->pin_threads = FALSE;
+        else
+          print_error("Invalid option for parameter 'pin_threads': must be 'true' or 'false'");
+      }
+      else print_error("Error reading command line input '-pin_threads'");
+    }
+
+    // Huge page backing of banks and tallies (-huge_pages)
+    else if(strcmp(arg, "-huge_pages") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "none") == 0)
+          parameters->huge_pages = HUGE_NONE;
+        else if(strcasecmp(argv[i], "thp") == 0)
+          parameters->huge_pages = HUGE_THP;
+        else if(strcasecmp(argv[i], "hugetlbfs") == 0)
+          parameters->huge_pages = HUGE_HUGETLBFS;
+        else
+          print_error("Invalid option for parameter 'huge_pages': must be 'none', 'thp' or 'hugetlbfs'");
+      }
+      else print_error("Error reading command line input '-huge_pages'");
+    }
+
+    // SIMD variant of the kernels (-simd)
+    else if(strcmp(arg, "-simd") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "auto") == 0)
+          parameters->simd = SIMD_AUTO;
+        else if(strcasecmp(argv[i], "scalar") == 0)
+          parameters->simd = SIMD_SCALAR;
+        else if(strcasecmp(argv[i], "avx2") == 0)
+          parameters->simd = SIMD_AVX2;
+        else if(strcasecmp(argv[i], "avx512") == 0)
+          parameters->simd = SIMD_AVX512;
+        else
+          print_error("Invalid option for parameter 'simd': must be 'auto', 'scalar', 'avx2' or 'avx512'");
+      }
+      else print_error("Error reading command line input '-simd'");
+    }
+
     // RNG seed (-seed)
     else if(strcmp(arg, "-seed") == 0){
       if(++i < argc) parameters->seed = atol(argv[i]);
@@ -383,6 +997,213 @@ void read_CLI(int argc, char *argv[], Parameters *parameters)
       else print_error("Error reading command line input '-save_source'");
     }
 
+    // Whether to resume from the restart file (-resume)
+    else if(strcmp(arg, "-resume") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "true") == 0)
+          parameters->resume = TRUE;
+        else if(strcasecmp(argv[i], "false") == 0)
+          parameters->resume = FALSE;
+        else
+          print_error("Invalid option for parameter 'resume': must be 'true' or 'false'");
+      }
+      else print_error("Error reading command line input '-resume'");
+    }
+
+    // Seconds after SIGTERM by which the restart file is written (-shutdown_deadline)
+    else if(strcmp(arg, "-shutdown_deadline") == 0){
+      if(++i < argc) parameters->shutdown_deadline = atof(argv[i]);
+      else print_error("Error reading command line input '-shutdown_deadline'");
+    }
+
+    // Path to write the restart file to and resume from (-restart_file)
+    else if(strcmp(arg, "-restart_file") == 0){
+      if(++i < argc){
+        if(parameters->restart_file != NULL) free(parameters->restart_file);
+        parameters->restart_file = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->restart_file, argv[i]);
+      }
+      else print_error("Error reading command line input '-restart_file'");
+    }
+
+    // Surface whose crossings are written to the surface source file (-surface_write)
+    else if(strcmp(arg, "-surface_write") == 0){
+      if(++i < argc) parameters->surface_write = read_surface(argv[i]);
+      else print_error("Error reading command line input '-surface_write'");
+    }
+
+    // Whether a fixed source is sampled from the surface source file (-surface_read)
+    else if(strcmp(arg, "-surface_read") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "true") == 0)
+          parameters->surface_read = TRUE;
+        else if(strcasecmp(argv[i], "false") == 0)
+          parameters->surface_read = FALSE;
+        else
+          print_error("Invalid option for parameter 'surface_read': must be 'true' or 'false'");
+      }
+      else print_error("Error reading command line input '-surface_read'");
+    }
+
+    // Number of times each surface source site is used (-surface_reuse)
+    else if(strcmp(arg, "-surface_reuse") == 0){
+      if(++i < argc) parameters->surface_reuse = atoi(argv[i]);
+      else print_error("Error reading command line input '-surface_reuse'");
+    }
+
+    // Path to write the surface source to and read it from (-surface_file)
+    else if(strcmp(arg, "-surface_file") == 0){
+      if(++i < argc){
+        if(parameters->surface_file != NULL) free(parameters->surface_file);
+        parameters->surface_file = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->surface_file, argv[i]);
+      }
+      else print_error("Error reading command line input '-surface_file'");
+    }
+
+    // Shared object that samples the source (-source_plugin)
+    else if(strcmp(arg, "-source_plugin") == 0){
+      if(++i < argc){
+        if(parameters->source_plugin != NULL) free(parameters->source_plugin);
+        parameters->source_plugin = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->source_plugin, argv[i]);
+      }
+      else print_error("Error reading command line input '-source_plugin'");
+    }
+
+    // Argument string passed to the source plugin (-source_plugin_args)
+    else if(strcmp(arg, "-source_plugin_args") == 0){
+      if(++i < argc){
+        if(parameters->source_plugin_args != NULL) free(parameters->source_plugin_args);
+        parameters->source_plugin_args = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->source_plugin_args, argv[i]);
+      }
+      else print_error("Error reading command line input '-source_plugin_args'");
+    }
+
+    // Number of sites the source plugin samples per call (-source_chunk)
+    else if(strcmp(arg, "-source_chunk") == 0){
+      if(++i < argc) parameters->source_chunk = atol(argv[i]);
+      else print_error("Error reading command line input '-source_chunk'");
+    }
+
+    // Whether to sample where the run spends its time (-profile)
+    else if(strcmp(arg, "-profile") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "true") == 0)
+          parameters->profile = TRUE;
+        else if(strcasecmp(argv[i], "false") == 0)
+          parameters->profile = FALSE;
+        else
+          print_error("Invalid option for parameter 'profile': must be 'true' or 'false'");
+      }
+      else print_error("Error reading command line input '-profile'");
+    }
+
+    // Profiler samples per second of cpu time on each thread (-profile_rate)
+    else if(strcmp(arg, "-profile_rate") == 0){
+      if(++i < argc) parameters->profile_rate = atof(argv[i]);
+      else print_error("Error reading command line input '-profile_rate'");
+    }
+
+    // Whether to map the events and time spent in each tally bin (-cost_map)
+    else if(strcmp(arg, "-cost_map") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "true") == 0)
+          parameters->cost_map = TRUE;
+        else if(strcasecmp(argv[i], "false") == 0)
+          parameters->cost_map = FALSE;
+        else
+          print_error("Invalid option for parameter 'cost_map': must be 'true' or 'false'");
+      }
+      else print_error("Error reading command line input '-cost_map'");
+    }
+
+    // Path to write the cost map to (-cost_file)
+    else if(strcmp(arg, "-cost_file") == 0){
+      if(++i < argc){
+        if(parameters->cost_file != NULL) free(parameters->cost_file);
+        parameters->cost_file = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->cost_file, argv[i]);
+      }
+      else print_error("Error reading command line input '-cost_file'");
+    }
+
+    // Whether to read the RAPL energy counters (-energy)
+    else if(strcmp(arg, "-energy") == 0){
+      if(++i < argc){
+        if(strcasecmp(argv[i], "true") == 0)
+          parameters->energy = TRUE;
+        else if(strcasecmp(argv[i], "false") == 0)
+          parameters->energy = FALSE;
+        else
+          print_error("Invalid option for parameter 'energy': must be 'true' or 'false'");
+      }
+      else print_error("Error reading command line input '-energy'");
+    }
+
+    // Path to write the run's metrics to as JSON (-benchmark_file)
+    else if(strcmp(arg, "-benchmark_file") == 0){
+      if(++i < argc){
+        if(parameters->benchmark_file != NULL) free(parameters->benchmark_file);
+        parameters->benchmark_file = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->benchmark_file, argv[i]);
+      }
+      else print_error("Error reading command line input '-benchmark_file'");
+    }
+
+    // Directory of converged sources shared between runs (-source_cache)
+    else if(strcmp(arg, "-source_cache") == 0){
+      if(++i < argc){
+        if(parameters->source_cache != NULL) free(parameters->source_cache);
+        parameters->source_cache = malloc(strlen(argv[i])*sizeof(char)+1);
+        strcpy(parameters->source_cache, argv[i]);
+      }
+      else print_error("Error reading command line input '-source_cache'");
+    }
+
+    // MB the source cache may grow to (-cache_size)
+    else if(strcmp(arg, "-cache_size") == 0){
+      if(++i < argc) parameters->cache_size = atof(argv[i]);
+      else print_error("Error reading command line input '-cache_size'");
+    }
+
+    // Number of inactive batches when starting from a cached source (-cached_inactive)
+    else if(strcmp(arg, "-cached_inactive") == 0){
+      if(++i < argc) parameters->cached_inactive = atoi(argv[i]);
+      else print_error("Error reading command line input '-cached_inactive'");
+    }
+
+    // Largest relative parameter difference to use a cached source (-cache_tolerance)
+    else if(strcmp(arg, "-cache_tolerance") == 0){
+      if(++i < argc) parameters->cache_tolerance = atof(argv[i]);
+      else print_error("Error reading command line input '-cache_tolerance'");
+    }
+
+    // Number of burnup steps (-depletion_steps)
+    else if(strcmp(arg, "-depletion_steps") == 0){
+      if(++i < argc) parameters->depletion_steps = atoi(argv[i]);
+      else print_error("Error reading command line input '-depletion_steps'");
+    }
+
+    // Length of each burnup step in days (-step_length)
+    else if(strcmp(arg, "-step_length") == 0){
+      if(++i < argc) parameters->step_length = atof(argv[i]);
+      else print_error("Error reading command line input '-step_length'");
+    }
+
+    // Power the flux is normalized to when depleting (-power)
+    else if(strcmp(arg, "-power") == 0){
+      if(++i < argc) parameters->power = atof(argv[i]);
+      else print_error("Error reading command line input '-power'");
+    }
+
+    // Number of inactive batches of each burnup step after the first (-depletion_inactive)
+    else if(strcmp(arg, "-depletion_inactive") == 0){
+      if(++i < argc) parameters->depletion_inactive = atoi(argv[i]);
+      else print_error("Error reading command line input '-depletion_inactive'");
+    }
+
     // Whether to output tally (-write_tally)
     else if(strcmp(arg, "-write_tally") == 0){
       if(++i < argc){
@@ -513,6 +1334,114 @@ void read_CLI(int argc, char *argv[], Parameters *parameters)
     parameters->bank_file = "bank.dat";
   if(parameters->write_source == TRUE && parameters->source_file == NULL)
     parameters->source_file = "source.dat";
+  if(parameters->restart_file == NULL)
+    parameters->restart_file = "restart.dat";
+  if(parameters->shutdown_deadline <= 0)
+    print_error("Shutdown deadline must be positive");
+  if(parameters->surface_file == NULL)
+    parameters->surface_file = "surface_source.dat";
+  if(parameters->source_plugin_args == NULL)
+    parameters->source_plugin_args = "";
+  if(parameters->source_chunk < 1)
+    print_error("Source plugin chunk must be at least 1 site");
+  if(parameters->profile == TRUE && (parameters->profile_rate <= 0 || parameters->profile_rate > 1.0e6))
+    print_error("Profiler rate must be positive and at most 1e6 samples per second");
+  if(parameters->cost_file == NULL)
+    parameters->cost_file = "cost.dat";
+  if(parameters->cost_map == TRUE && parameters->solver == RANDOM_RAY)
+    print_error("The cost map is only kept by the Monte Carlo solver");
+  if(parameters->source_plugin != NULL && (parameters->mode == ADJOINT ||
+     parameters->surface_read == TRUE || parameters->symmetry == OCTANT))
+    print_error("A source plugin can't be used in adjoint mode, with a surface source or with symmetry");
+  if(parameters->surface_write != NO_SURFACE && parameters->geometry == TET_MESH)
+    print_error("Surface sources can only be written on a box");
+  if(parameters->surface_read == TRUE && parameters->mode != FORWARD)
+    print_error("A surface source can only be read in forward mode");
+  if(parameters->surface_read == TRUE && parameters->surface_write != NO_SURFACE)
+    print_error("A run can't read and write a surface source at once");
+  if(parameters->surface_reuse < 1)
+    print_error("Surface source reuse must be at least 1");
+  if(parameters->cache_size < 0)
+    print_error("Source cache size cannot be negative");
+  if(parameters->cached_inactive < 0)
+    print_error("Number of inactive batches from a cached source cannot be negative");
+  if(parameters->cache_tolerance < 0)
+    print_error("Source cache tolerance cannot be negative");
+  if(parameters->population_float < 0 || parameters->population_float >= 1)
+    print_error("Population float must be in [0, 1)");
+  if(parameters->population_float > 0 && parameters->population_control != COMB)
+    print_error("Population can only float with 'comb' population control");
+  if(parameters->geometry == TET_MESH && parameters->mesh_file == NULL)
+    parameters->mesh_file = "mesh.dat";
+  if(parameters->geometry == TET_MESH && parameters->bc == PERIODIC)
+    print_error("Periodic boundary conditions are not supported on a tet mesh");
+  if(parameters->symmetry == OCTANT && parameters->geometry == TET_MESH)
+    print_error("Symmetry is only supported on a box");
+  if(parameters->symmetry == OCTANT && parameters->bc == PERIODIC)
+    print_error("Periodic boundary conditions can't be combined with symmetry");
+  if(parameters->symmetry == OCTANT && parameters->n_bins % 2 != 0)
+    print_error("Number of bins must be even with octant symmetry");
+  if(parameters->region[1] > parameters->region[0] &&
+     (parameters->region[3] <= parameters->region[2] || parameters->region[5] <= parameters->region[4]))
+    print_error("Region must have positive length in x, y, and z dimension");
+  if(parameters->source_region[1] > parameters->source_region[0] &&
+     (parameters->source_region[3] <= parameters->source_region[2] ||
+      parameters->source_region[5] <= parameters->source_region[4]))
+    print_error("Source region must have positive length in x, y, and z dimension");
+  if(parameters->mode != EIGENVALUE && parameters->resume == TRUE)
+    print_error("Only eigenvalue runs can be resumed");
+  if(parameters->solver == RANDOM_RAY && parameters->mode != EIGENVALUE)
+    print_error("The random ray solver only solves eigenvalue problems");
+  if(parameters->solver == RANDOM_RAY && parameters->n_generations != 1)
+    print_error("Each random ray iteration is a batch of one generation");
+  if(parameters->solver == RANDOM_RAY && (parameters->resume == TRUE ||
+     parameters->depletion_steps > 0 || parameters->point_detector == TRUE ||
+     parameters->surface_write != NO_SURFACE || parameters->source_cache != NULL))
+    print_error("Random ray runs can't resume, deplete, or use point detectors, surface sources or the source cache");
+  if(parameters->ray_dead_length < 0 || parameters->ray_active_length <= 0)
+    print_error("Random ray dead length cannot be negative and active length must be positive");
+  if(parameters->depletion_steps < 0)
+    print_error("Number of burnup steps cannot be negative");
+  if(parameters->depletion_steps > 0 && parameters->mode != EIGENVALUE)
+    print_error("Depletion is only supported in eigenvalue mode");
+  if(parameters->depletion_steps > 0 && parameters->resume == TRUE)
+    print_error("A depletion run can't be resumed");
+  if(parameters->step_length <= 0)
+    print_error("Burnup step length must be positive");
+  if(parameters->power <= 0)
+    print_error("Power must be positive");
+  if(parameters->depletion_inactive < 0)
+    print_error("Number of inactive batches of a burnup step cannot be negative");
+  // Every batch of a fixed source run is active
+  if(parameters->mode != EIGENVALUE)
+    parameters->n_active = parameters->n_batches;
+  if(parameters->forced_collision == TRUE && parameters->geometry == TET_MESH)
+    print_error("Forced collisions are not supported on a tet mesh");
+  if(parameters->exp_transform < 0 || parameters->exp_transform >= 1)
+    print_error("Exponential transform parameter must be in [0, 1)");
+  if(parameters->exp_transform > 0){
+    double norm = sqrt(parameters->exp_direction[0]*parameters->exp_direction[0] +
+       parameters->exp_direction[1]*parameters->exp_direction[1] +
+       parameters->exp_direction[2]*parameters->exp_direction[2]);
+    if(norm == 0)
+      print_error("Exponential transform direction cannot be zero");
+    for(i=0; i<3; i++){
+      parameters->exp_direction[i] /= norm;
+    }
+  }
+  if(parameters->weight_cutoff <= 0 || parameters->weight_cutoff >= 1)
+    print_error("Weight cutoff must be in (0, 1)");
+  if(parameters->exclusion_radius < 0)
+    print_error("Exclusion radius cannot be negative");
+  if(parameters->point_detector == TRUE && parameters->mode == ADJOINT)
+    print_error("The point detector is a forward estimator and can't be used in adjoint mode");
+  if(parameters->point_detector == TRUE && (parameters->bc != VACUUM || parameters->symmetry != NO_SYMMETRY))
+    print_error("The point detector only scores the direct flight, so it needs vacuum boundaries and no symmetry");
+  if(parameters->point_detector == TRUE && parameters->geometry != TET_MESH &&
+     (parameters->detector[0] < 0 || parameters->detector[0] > parameters->Lx ||
+      parameters->detector[1] < 0 || parameters->detector[1] > parameters->Ly ||
+      parameters->detector[2] < 0 || parameters->detector[2] > parameters->Lz))
+    print_error("The point detector must lie inside the box");
   if(parameters->n_batches < 1 && parameters->n_generations < 1)
     print_error("Must have at least one batch or one generation");
   if(parameters->n_batches < 0)
@@ -523,6 +1452,8 @@ void read_CLI(int argc, char *argv[], Parameters *parameters)
     print_error("Number of active batches cannot be greater than number of batches");
   if(parameters->n_bins < 0)
     print_error("Number of bins cannot be negative");
+  if(parameters->n_threads < 1)
+    print_error("Number of threads must be greater than 0");
   if(parameters->nu < 0)
     print_error("Average number of fission neutrons produced cannot be negative");
   if(parameters->Lx <= 0 || parameters->Ly <= 0 || parameters->Lz <= 0)
@@ -536,6 +1467,15 @@ void read_CLI(int argc, char *argv[], Parameters *parameters)
 void print_parameters(Parameters *parameters)
 {
   char *bc = NULL;
+  char *huge_pages = NULL;
+  char *simd = NULL;
+  if(parameters->simd == SIMD_AUTO) simd = "Auto";
+  else if(parameters->simd == SIMD_SCALAR) simd = "Scalar";
+  else if(parameters->simd == SIMD_AVX2) simd = "AVX2";
+  else if(parameters->simd == SIMD_AVX512) simd = "AVX-512";
+  if(parameters->huge_pages == HUGE_NONE) huge_pages = "None";
+  else if(parameters->huge_pages == HUGE_THP) huge_pages = "Transparent";
+  else if(parameters->huge_pages == HUGE_HUGETLBFS) huge_pages = "hugetlbfs";
   if(parameters->bc == 0) bc = "Vacuum";
   else if(parameters->bc == 1) bc = "Reflective";
   else if(parameters->bc == 2) bc = "Periodic";
@@ -546,12 +1486,141 @@ void print_parameters(Parameters *parameters)
   printf("Number of batches:              %d\n", parameters->n_batches);
   printf("Number of active batches:       %d\n", parameters->n_active);
   printf("Number of generations:          %d\n", parameters->n_generations);
+  if(parameters->geometry == TET_MESH)
+    printf("Geometry:                       Tet mesh (%s)\n", parameters->mesh_file);
+  else
+    printf("Geometry:                       Box\n");
   printf("Boundary conditions:            %s\n", bc);
+  if(parameters->symmetry == OCTANT)
+    printf("Symmetry:                       Octant\n");
+  if(parameters->mode == FORWARD)
+    printf("Mode:                           Forward fixed source\n");
+  else if(parameters->mode == ADJOINT)
+    printf("Mode:                           Adjoint fixed source\n");
+  else if(parameters->solver == RANDOM_RAY)
+    printf("Mode:                           Eigenvalue, random ray (dead %g cm, active %g cm)\n",
+       parameters->ray_dead_length, parameters->ray_active_length);
+  else
+    printf("Mode:                           Eigenvalue\n");
+  if(parameters->population_control == COMB)
+    printf("Population control:             Comb (float %g)\n", parameters->population_float);
+  else
+    printf("Population control:             Reservoir\n");
+  if(parameters->fission_banking == IMPLICIT)
+    printf("Fission banking:                Implicit\n");
+  else
+    printf("Fission banking:                Analog\n");
   printf("Number of nuclides in material: %d\n", parameters->n_nuclides);
+  if(parameters->forced_collision == TRUE)
+    printf("Forced collisions:              On\n");
+  if(parameters->exp_transform > 0)
+    printf("Exponential transform:          %g along (%g, %g, %g)\n",
+       parameters->exp_transform, parameters->exp_direction[0],
+       parameters->exp_direction[1], parameters->exp_direction[2]);
+  if(parameters->point_detector == TRUE)
+    printf("Point detector:                 (%g, %g, %g), exclusion radius %g\n",
+       parameters->detector[0], parameters->detector[1], parameters->detector[2],
+       parameters->exclusion_radius);
+  printf("Number of threads:              %d\n", parameters->n_threads);
+  printf("Huge pages:                     %s\n", huge_pages);
+  printf("SIMD kernels:                   %s\n", simd);
+  if(parameters->resume == TRUE)
+    printf("Resuming from:                  %s\n", parameters->restart_file);
+  if(parameters->surface_write != NO_SURFACE)
+    printf("Surface source written to:      %s\n", parameters->surface_file);
+  if(parameters->surface_read == TRUE)
+    printf("Surface source read from:       %s (reuse %d)\n", parameters->surface_file, parameters->surface_reuse);
+  if(parameters->source_plugin != NULL)
+    printf("Source plugin:                  %s (%s)\n", parameters->source_plugin, parameters->source_plugin_args);
+  if(parameters->source_cache != NULL)
+    printf("Source cache:                   %s (%g MB)\n", parameters->source_cache, parameters->cache_size);
+  if(parameters->depletion_steps > 0)
+    printf("Depletion:                      %d steps of %g days at %g W\n",
+       parameters->depletion_steps, parameters->step_length, parameters->power);
+  if(parameters->cost_map == TRUE)
+    printf("Cost map written to:            %s\n", parameters->cost_file);
+  if(parameters->energy == TRUE)
+    printf("Energy counters:                RAPL package and DRAM\n");
+  if(parameters->benchmark_file != NULL)
+    printf("Benchmark written to:           %s\n", parameters->benchmark_file);
+  if(parameters->profile == TRUE)
+    printf("Profiler:                       %g samples/sec per thread\n", parameters->profile_rate);
   printf("RNG seed:                       %llu\n", parameters->seed);
   border_print();
 }
 
+// Writes the parameters a specialized build folds in as a header of constants.
+// Doubles are printed with enough digits to round-trip exactly. With symmetry
+// the constants describe the modeled octant.
+void write_problem(Parameters *parameters, char *filename)
+{
+  double s = parameters->symmetry == OCTANT ? 0.5 : 1;
+  FILE *fp;
+
+  fp = fopen(filename, "w");
+  if(fp == NULL){
+    print_error("Couldn't open file for the specialized build header.");
+  }
+
+  fprintf(fp, "// Problem constants for a specialized build, written by\n");
+  fprintf(fp, "// 'transport -specialize' from the parameters of the problem\n");
+  fprintf(fp, "#define PROBLEM_GEOMETRY %s\n", parameters->geometry == TET_MESH ? "TET_MESH" : "BOX");
+  fprintf(fp, "#define PROBLEM_BC %d\n", parameters->bc);
+  fprintf(fp, "#define PROBLEM_SYMMETRY %d\n", parameters->symmetry);
+  if(parameters->geometry == BOX){
+    fprintf(fp, "#define PROBLEM_LX ((double)%.17g)\n", parameters->Lx*s);
+    fprintf(fp, "#define PROBLEM_LY ((double)%.17g)\n", parameters->Ly*s);
+    fprintf(fp, "#define PROBLEM_LZ ((double)%.17g)\n", parameters->Lz*s);
+    fprintf(fp, "#define PROBLEM_N_BINS %d\n", parameters->symmetry == OCTANT ? parameters->n_bins/2 : parameters->n_bins);
+    fprintf(fp, "#define PROBLEM_XS_T ((double)%.17g)\n", parameters->xs_a + parameters->xs_s);
+  }
+  fprintf(fp, "#define PROBLEM_NU ((double)%.17g)\n", parameters->nu);
+  fprintf(fp, "#define PROBLEM_FORCED_COLLISION %d\n", parameters->forced_collision);
+  fprintf(fp, "#define PROBLEM_EXP_TRANSFORM ((double)%.17g)\n", parameters->exp_transform);
+  fprintf(fp, "#define PROBLEM_WEIGHT_CUTOFF ((double)%.17g)\n", parameters->weight_cutoff);
+
+  fclose(fp);
+
+  return;
+}
+
+// A specialized build only runs the problem it was generated for
+void check_problem(Parameters *parameters)
+{
+#ifdef PROBLEM
+  double s = parameters->symmetry == OCTANT ? 0.5 : 1;
+
+  if(parameters->geometry != PROBLEM_GEOMETRY)
+    print_error("Parameter 'geometry' differs from the specialized build");
+  if(parameters->bc != PROBLEM_BC)
+    print_error("Parameter 'bc' differs from the specialized build");
+  if(parameters->symmetry != PROBLEM_SYMMETRY)
+    print_error("Parameter 'symmetry' differs from the specialized build");
+  if(parameters->solver == RANDOM_RAY)
+    print_error("Random ray runs use the general build");
+#ifdef PROBLEM_LX
+  if(parameters->Lx*s != PROBLEM_LX || parameters->Ly*s != PROBLEM_LY || parameters->Lz*s != PROBLEM_LZ)
+    print_error("Parameters 'Lx', 'Ly' or 'Lz' differ from the specialized build");
+  if(parameters->n_bins*s != PROBLEM_N_BINS)
+    print_error("Parameter 'n_bins' differs from the specialized build");
+  if(parameters->xs_a + parameters->xs_s != PROBLEM_XS_T)
+    print_error("Parameters 'xs_a' or 'xs_s' differ from the specialized build");
+  if(parameters->depletion_steps > 0)
+    print_error("Depletion changes the cross sections a specialized build folds in");
+#endif
+  if(parameters->nu != PROBLEM_NU)
+    print_error("Parameter 'nu' differs from the specialized build");
+  if(parameters->forced_collision != PROBLEM_FORCED_COLLISION)
+    print_error("Parameter 'forced_collision' differs from the specialized build");
+  if(parameters->exp_transform != PROBLEM_EXP_TRANSFORM)
+    print_error("Parameter 'exp_transform' differs from the specialized build");
+  if(parameters->weight_cutoff != PROBLEM_WEIGHT_CUTOFF)
+    print_error("Parameter 'weight_cutoff' differs from the specialized build");
+#endif
+
+  return;
+}
+
 void print_error(char *message)
 {
   printf("ERROR: %s\n", message);
@@ -596,6 +1665,11 @@ void init_output(Parameters *parameters)
 {
   FILE *fp = NULL; // file pointer for output
 
+  // A resumed run appends to the outputs of the run it picks up from
+  if(parameters->resume == TRUE){
+    return;
+  }
+
   // Set up file to output tallies
   if(parameters->write_tally == TRUE){
     fp = fopen(parameters->tally_file, "w");
@@ -626,24 +1700,159 @@ void init_output(Parameters *parameters)
     fclose(fp);
   }
 
+  // Set up file to output the surface source
+  if(parameters->surface_write != NO_SURFACE){
+    init_surface_file(parameters);
+  }
+
   return;
 }
 
-void write_tally(Tally *t, char *filename)
+// Index in the fundamental octant of bin i of the n bins along a symmetric
+// axis, mirrored about the symmetry plane in the middle
+static unsigned long unfold(int i, int n)
+{
+  return i < n/2 ? i : n - 1 - i;
+}
+
+// Writes the value v[stride*l] of each tally bin l. With symmetry the octant
+// is unfolded to the full domain and each value is split over the eight
+// bins it stands for, which scales the flux to a unit source over the full
+// domain rather than over the octant.
+static void write_bins(FILE *fp, Tally *t, double *v, int stride)
 {
   int i, j, k;
+  int n = t->n;
+  unsigned long l;
+
+  // Tallies on a tet mesh are written one element after another on one line
+  if(t->volume != NULL){
+    for(l=0; l<t->sz; l++){
+      fprintf(fp, "%e ", v[stride*l]);
+    }
+    fprintf(fp, "\n");
+  }
+  else if(t->symmetry == OCTANT){
+    for(i=0; i<2*n; i++){
+      for(j=0; j<2*n; j++){
+        for(k=0; k<2*n; k++){
+          fprintf(fp, "%e ", v[stride*(unfold(i, 2*n) + n*unfold(j, 2*n) + n*n*unfold(k, 2*n))]/8);
+        }
+        fprintf(fp, "\n");
+      }
+    }
+  }
+  else{
+    for(i=0; i<t->n; i++){
+      for(j=0; j<t->n; j++){
+        for(k=0; k<t->n; k++){
+          fprintf(fp, "%e ", v[stride*(i + t->n*j + t->n*t->n*k)]);
+        }
+        fprintf(fp, "\n");
+      }
+    }
+  }
+
+  return;
+}
+
+void write_tally(Tally *t, char *filename)
+{
   FILE *fp;
 
+  set_phase(PHASE_IO);
+
   fp = fopen(filename, "a");
+  write_bins(fp, t, t->flux, 1);
+  fclose(fp);
 
-  for(i=0; i<t->n; i++){
-    for(j=0; j<t->n; j++){
-      for(k=0; k<t->n; k++){
-        fprintf(fp, "%e ", t->flux[i + t->n*j + t->n*t->n*k]);
-      }
-      fprintf(fp, "\n");
+  return;
+}
+
+// Writes the collisions, crossings and cycles of each bin as three blocks in
+// the layout of the tally file
+void write_cost(Tally *t, char *filename)
+{
+  int i;
+  FILE *fp;
+
+  set_phase(PHASE_IO);
+
+  fp = fopen(filename, "w");
+  if(fp == NULL){
+    print_error("Couldn't open the cost map file");
+  }
+  for(i=0; i<N_COSTS; i++){
+    if(i > 0) fprintf(fp, "\n");
+    write_bins(fp, t, t->cost + i, N_COSTS);
+  }
+  fclose(fp);
+
+  return;
+}
+
+// Writes the metrics of a completed run that transported n_histories particles
+// in t seconds as a JSON object. energy holds the package and DRAM energy of
+// the run, or is NULL without energy counters.
+void write_benchmark(Parameters *parameters, Tally *tally, double *keff, double n_histories, double t, double *energy, char *filename)
+{
+  int i, n;
+  double mean, std;
+  FILE *fp;
+
+  set_phase(PHASE_IO);
+
+  fp = fopen(filename, "w");
+  if(fp == NULL){
+    print_error("Couldn't open the benchmark file");
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"mode\": \"%s\",\n", parameters->mode == EIGENVALUE ? "eigenvalue" :
+     parameters->mode == FORWARD ? "forward" : "adjoint");
+  fprintf(fp, "  \"particles\": %lu,\n", parameters->n_particles);
+  fprintf(fp, "  \"batches\": %d,\n", parameters->n_batches);
+  fprintf(fp, "  \"generations\": %d,\n", parameters->n_generations);
+  fprintf(fp, "  \"threads\": %d,\n", parameters->n_threads);
+  fprintf(fp, "  \"histories\": %.0f,\n", n_histories);
+  fprintf(fp, "  \"simulation_time\": %e,\n", t);
+  fprintf(fp, "  \"tracking_rate\": %e,\n", n_histories/t);
+
+  // Keff in eigenvalue mode, the region response otherwise
+  if(parameters->mode == EIGENVALUE){
+    n = parameters->n_active;
+    calculate_keff(keff, &mean, &std, n);
+    fprintf(fp, "  \"keff\": %.8f,\n", mean);
+    fprintf(fp, "  \"keff_error\": %.8f,\n", n > 1 ? std/sqrt(n) : 0);
+  }
+  else{
+    n = parameters->n_batches;
+    calculate_keff(tally->region_batch, &mean, &std, n);
+    fprintf(fp, "  \"response\": %e,\n", mean);
+    fprintf(fp, "  \"response_error\": %e,\n", n > 1 ? std/sqrt(n) : 0);
+  }
+
+  fprintf(fp, "  \"phase_time\": {");
+  for(i=0; i<N_PHASES; i++){
+    fprintf(fp, "\"%s\": %e%s", PHASE_NAMES[i], phase_time[i], i < N_PHASES-1 ? ", " : "},\n");
+  }
+
+  if(energy != NULL){
+    fprintf(fp, "  \"energy\": {\n");
+    fprintf(fp, "    \"package\": %e,\n", energy[0]);
+    fprintf(fp, "    \"dram\": %e,\n", energy[1]);
+    fprintf(fp, "    \"joules_per_particle\": %e,\n", (energy[0] + energy[1])/n_histories);
+    fprintf(fp, "    \"average_power\": %e,\n", (energy[0] + energy[1])/t);
+    fprintf(fp, "    \"phase\": {");
+    for(i=0; i<N_PHASES; i++){
+      fprintf(fp, "\"%s\": %e%s", PHASE_NAMES[i], phase_energy[i], i < N_PHASES-1 ? ", " : "}\n");
     }
+    fprintf(fp, "  }\n");
   }
+  else{
+    fprintf(fp, "  \"energy\": null\n");
+  }
+  fprintf(fp, "}\n");
 
   fclose(fp);
 
@@ -654,6 +1863,8 @@ void write_entropy(double H, char *filename)
 {
   FILE *fp;
 
+  set_phase(PHASE_IO);
+
   fp = fopen(filename, "a");
   fprintf(fp, "%.10f\n", H);
   fclose(fp);
@@ -666,6 +1877,8 @@ void write_keff(double *keff, int n, char *filename)
   int i;
   FILE *fp;
 
+  set_phase(PHASE_IO);
+
   fp = fopen(filename, "a");
 
   for(i=0; i<n; i++){
@@ -679,9 +1892,11 @@ void write_keff(double *keff, int n, char *filename)
 
 void write_bank(Bank *b, char *filename)
 {
-  int i;
+  unsigned long i;
   FILE *fp;
 
+  set_phase(PHASE_IO);
+
   fp = fopen(filename, "a");
 
   for(i=0; i<b->n; i++){
@@ -693,27 +1908,33 @@ void write_bank(Bank *b, char *filename)
   return;
 }
 
-void write_source(Parameters *parameters, Geometry *geometry, Bank *b, char *filename)
+void write_source(Parameters *parameters, Geometry *geometry, Bank *b, Arena *scratch, char *filename)
 {
   int i, j, k;
   double dx, dy, dz;
   unsigned long ix, iy, iz;
   unsigned long l;
   unsigned long n;
+  unsigned long n_full;
   double *dist;
   Particle *p;
   FILE *fp;
 
-  // Number of grid boxes in each dimension
-  n = parameters->n_bins;
+  set_phase(PHASE_IO);
+
+  // Number of grid boxes in each dimension, over the octant with symmetry
+  n_full = parameters->n_bins;
+  n = geometry->symmetry == OCTANT ? n_full/2 : n_full;
 
   // Find grid spacing
   dx = geometry->Lx/n;
   dy = geometry->Ly/n;
   dz = geometry->Lz/n;
 
-  // Allocate array to keep track of number of sites in each grid box
-  dist = calloc(n*n*n, sizeof(double));
+  // Array to keep track of number of sites in each grid box
+  arena_reset(scratch);
+  dist = arena_alloc(scratch, n*n*n*sizeof(double));
+  memset(dist, 0, n*n*n*sizeof(double));
 
   for(l=0; l<b->n; l++){
     p = &(b->p[l]);
@@ -733,19 +1954,30 @@ void write_source(Parameters *parameters, Geometry *geometry, Bank *b, char *fil
 
   fp = fopen(filename, "a");
 
-  for(i=0; i<n; i++){
-    for(j=0; j<n; j++){
-      for(k=0; k<n; k++){
-        fprintf(fp, "%e ", dist[i + n*j + n*n*k]);
+  // Unfold the octant, whose sites stand for an eighth of the source each
+  if(geometry->symmetry == OCTANT){
+    for(i=0; i<n_full; i++){
+      for(j=0; j<n_full; j++){
+        for(k=0; k<n_full; k++){
+          fprintf(fp, "%e ", dist[unfold(i, n_full) + n*unfold(j, n_full) + n*n*unfold(k, n_full)]/8);
+        }
+        fprintf(fp, "\n");
+      }
+    }
+  }
+  else{
+    for(i=0; i<n; i++){
+      for(j=0; j<n; j++){
+        for(k=0; k<n; k++){
+          fprintf(fp, "%e ", dist[i + n*j + n*n*k]);
+        }
+        fprintf(fp, "\n");
       }
-      fprintf(fp, "\n");
     }
   }
 
   fclose(fp);
 
-  free(dist);
-
   return;
 }
 
@@ -3,25 +3,54 @@
 int main(int argc, char *argv[])
 {
   Parameters *parameters; // user defined parameters
-  Geometry *geometry; // homogenous cube geometry
+  Pool *pool; // persistent pool of worker threads
+  Geometry *geometry; // homogenous cube or tet mesh geometry
   Material *material; // problem material
   Bank *source_bank; // array for particle source sites
   Bank *fission_bank; // array for particle fission sites
   Tally *tally; // scalar flux tally
   double *keff; // effective multiplication factor
   double t1, t2; // timers
+  double mean, std; // mean and standard deviation over active batches
+  unsigned long n_huge, n_pages; // huge pages obtained and requested
+  int i;
+  int completed; // whether the run finished rather than stopping for a shutdown
+  double e1[2], e2[2]; // package and DRAM energy counters at the start and stop
+  double *energy = NULL; // package and DRAM energy of the run, NULL without counters
 
   // Get inputs: set parameters to default values, parse parameter file,
   // override with any command line inputs, and print parameters
   parameters = init_parameters();
   parse_parameters(parameters);
   read_CLI(argc, argv, parameters);
-  print_parameters(parameters);
+
+  // Only write the header for a specialized build
+  if(parameters->problem_file != NULL){
+    write_problem(parameters, parameters->problem_file);
+    printf("Wrote specialized build header %s\n", parameters->problem_file);
+    return 0;
+  }
+  check_problem(parameters);
+
+  // Find the energy counters, turning energy off if they can't be read
+  init_energy(parameters);
 
   // Set initial RNG seed
   set_initial_seed(parameters->seed);
   set_stream(STREAM_OTHER);
 
+  // Choose how banks and tallies are backed
+  set_huge_pages(parameters->huge_pages);
+
+  // Pick the SIMD variant of each kernel for this cpu
+  init_kernels(parameters);
+
+  // Sample where the main thread and workers spend their time
+  init_profiler(parameters);
+
+  // Start the worker threads once for the whole run
+  pool = init_pool(parameters);
+
   // Create files for writing results to
   init_output(parameters);
 
@@ -29,10 +58,10 @@ int main(int argc, char *argv[])
   geometry = init_geometry(parameters);
 
   // Set up material
-  material = init_material(parameters);
+  material = init_material(parameters, geometry);
 
   // Set up tallies
-  tally = init_tally(parameters);
+  tally = init_tally(parameters, geometry);
 
   // Create source bank and initial source distribution
   source_bank = init_source_bank(parameters, geometry);
@@ -40,31 +69,124 @@ int main(int argc, char *argv[])
   // Create fission bank
   fission_bank = init_fission_bank(parameters);
 
+  // Print the parameters once a cached source may have cut the batches
+  print_parameters(parameters);
+
   // Set up array for k effective
   keff = calloc(parameters->n_active, sizeof(double));
 
   center_print("SIMULATION", 79);
   border_print();
-  printf("%-15s %-15s %-15s %-15s\n", "BATCH", "ENTROPY", "KEFF", "MEAN KEFF");
+  if(parameters->mode == EIGENVALUE)
+    printf("%-15s %-15s %-15s %-15s\n", "BATCH", "ENTROPY", "KEFF", "MEAN KEFF");
+  else
+    printf("%-15s %-15s %-15s %-15s\n", "BATCH", "GENERATIONS", "RESPONSE", "MEAN RESPONSE");
+
+  // Stop at a generation boundary and write a restart file on SIGTERM
+  init_signals();
 
   // Start time
+  reset_phase_times();
   t1 = timer();
-
-  run_eigenvalue(parameters, geometry, material, source_bank, fission_bank, tally, keff);
+  read_energy(&e1[0], &e1[1]);
+
+  if(parameters->solver == RANDOM_RAY){
+    completed = run_random_ray(parameters, pool, geometry, material, tally, keff);
+  }
+  else if(parameters->mode == EIGENVALUE && parameters->depletion_steps > 0){
+    completed = run_depletion(parameters, pool, geometry, material, source_bank, fission_bank, tally, keff);
+  }
+  else if(parameters->mode == EIGENVALUE){
+    completed = run_eigenvalue(parameters, pool, geometry, material, source_bank, fission_bank, tally, keff);
+  }
+  else{
+    completed = run_fixed_source(parameters, pool, geometry, material, source_bank, fission_bank, tally);
+  }
 
   // Stop time
   t2 = timer();
-
-  printf("Simulation time: %f secs\n", t2-t1);
+  set_phase(PHASE_OTHER);
+  if(read_energy(&e2[0], &e2[1]) == TRUE){
+    e2[0] -= e1[0];
+    e2[1] -= e1[1];
+    energy = e2;
+  }
+
+  // A run stopped by a shutdown signal only reports where to resume from
+  if(completed == TRUE){
+    printf("Simulation time: %f secs\n", t2-t1);
+    printf("Tracking rate: %e particles/sec\n", pool->n_histories/(t2-t1));
+    printf("Dispatch overhead: %.2f us/generation\n",
+       pool->t_dispatch/pool->n_generations*1.0e6);
+    printf("Phase times (secs):");
+    for(i=0; i<N_PHASES; i++){
+      printf(" %s %.3f%s", PHASE_NAMES[i], phase_time[i], i < N_PHASES-1 ? "," : "\n");
+    }
+    if(energy != NULL){
+      printf("Energy: %.1f J package, %.1f J DRAM\n", energy[0], energy[1]);
+      printf("Energy per particle: %e J\n", (energy[0] + energy[1])/pool->n_histories);
+      printf("Average power: %.1f W\n", (energy[0] + energy[1])/(t2-t1));
+      printf("Phase energy (J):");
+      for(i=0; i<N_PHASES; i++){
+        printf(" %s %.1f%s", PHASE_NAMES[i], phase_energy[i], i < N_PHASES-1 ? "," : "\n");
+      }
+    }
+    // Figure of merit 1/(R^2 T), with R the relative error of the mean
+    if(parameters->mode != EIGENVALUE && parameters->n_batches > 1){
+      calculate_keff(tally->region_batch, &mean, &std, parameters->n_batches);
+      printf("Response: %e +/- %e\n", mean, std/sqrt(parameters->n_batches));
+      printf("Response FOM: %e\n", fom(mean, std, parameters->n_batches, t2-t1));
+    }
+    else if(parameters->n_active > 1){
+      calculate_keff(keff, &mean, &std, parameters->n_active);
+      printf("Keff FOM: %e\n", fom(mean, std, parameters->n_active, t2-t1));
+      if(parameters->tally == TRUE){
+        calculate_keff(tally->region_batch, &mean, &std, parameters->n_active);
+        printf("Region flux: %e +/- %e\n", mean, std/sqrt(parameters->n_active));
+        printf("Region flux FOM: %e\n", fom(mean, std, parameters->n_active, t2-t1));
+      }
+    }
+    if(parameters->point_detector == TRUE && parameters->n_active > 1 &&
+       (parameters->tally == TRUE || parameters->mode != EIGENVALUE)){
+      calculate_keff(tally->point_batch, &mean, &std, parameters->n_active);
+      printf("Point detector flux: %e +/- %e\n", mean, std/sqrt(parameters->n_active));
+      printf("Point detector FOM: %e\n", fom(mean, std, parameters->n_active, t2-t1));
+    }
+    if(tally->cost != NULL){
+      write_cost(tally, parameters->cost_file);
+      printf("Cost map: %.0f collisions, %.0f crossings, %.1f cycles/event\n",
+         cost_total(tally, COST_COLLISIONS), cost_total(tally, COST_CROSSINGS),
+         cost_total(tally, COST_CYCLES)/(cost_total(tally, COST_COLLISIONS) + cost_total(tally, COST_CROSSINGS)));
+    }
+    if(geometry->plugin != NULL && geometry->plugin->t_sample > 0){
+      printf("Source plugin rate: %e sites/sec\n", geometry->plugin->n_sampled/geometry->plugin->t_sample);
+    }
+    print_kernels();
+    printf("Peak scratch memory: %.3f MB\n", pool->scratch->peak/1.0e6);
+    if(parameters->huge_pages != HUGE_NONE){
+      huge_page_usage(&n_huge, &n_pages);
+      printf("Huge pages obtained: %lu of %lu\n", n_huge, n_pages);
+    }
+    if(parameters->benchmark_file != NULL){
+      write_benchmark(parameters, tally, keff, pool->n_histories, t2-t1, energy, parameters->benchmark_file);
+    }
+  }
+
+  // Symbolize the samples while the source plugin is still loaded
+  print_profile();
 
   // Free memory
   free(keff);
+  free_pool(pool);
   free_tally(tally);
   free_bank(fission_bank);
   free_bank(source_bank);
-  free_material(material);
-  free(geometry);
+  free_material(material, geometry->n_materials);
+  free_geometry(geometry);
+  free_energy();
   free(parameters);
 
-  return 0;
+  // A stopped run exits with EX_TEMPFAIL so a job script can tell it needs
+  // resuming
+  return completed == TRUE ? 0 : EX_TEMPFAIL;
 }
@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include "simple_mc.h"
+#include<sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2UL*1024*1024)
+
+// An array huge_malloc was asked to back with huge pages
+typedef struct Region_{
+  void *ptr; // start of the usable memory
+  size_t sz; // size of the mapping, in whole huge pages
+  int mapped; // whether it was mapped, or fell back to malloc
+} Region;
+
+static int mode = HUGE_NONE;
+static Region *regions = NULL;
+static int n_regions = 0;
+static int sz_regions = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set how large arrays are backed
+void set_huge_pages(int huge_pages)
+{
+  mode = huge_pages;
+
+  return;
+}
+
+static void add_region(void *ptr, size_t sz, int mapped)
+{
+  pthread_mutex_lock(&lock);
+  if(n_regions == sz_regions){
+    sz_regions = sz_regions == 0 ? 16 : 2*sz_regions;
+    regions = realloc(regions, sz_regions*sizeof(Region));
+  }
+  regions[n_regions].ptr = ptr;
+  regions[n_regions].sz = sz;
+  regions[n_regions].mapped = mapped;
+  n_regions++;
+  pthread_mutex_unlock(&lock);
+
+  return;
+}
+
+// Removes the region starting at ptr from the list and returns the size of
+// its mapping, or 0 if ptr was not mapped by huge_malloc
+static size_t remove_region(void *ptr)
+{
+  int i;
+  size_t sz = 0;
+
+  pthread_mutex_lock(&lock);
+  for(i=0; i<n_regions; i++){
+    if(regions[i].ptr == ptr){
+      sz = regions[i].mapped == TRUE ? regions[i].sz : 0;
+      regions[i] = regions[--n_regions];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  return sz;
+}
+
+// Whether ptr is an array huge_malloc was asked for, mapped or not
+static int huge_tracked(void *ptr)
+{
+  int i;
+  int tracked = FALSE;
+
+  pthread_mutex_lock(&lock);
+  for(i=0; i<n_regions; i++){
+    if(regions[i].ptr == ptr){
+      tracked = TRUE;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  return tracked;
+}
+
+// Maps sz bytes aligned to a huge page boundary and asks the kernel to back
+// them with transparent huge pages
+static void *map_thp(size_t sz)
+{
+  char *p, *aligned;
+  size_t head;
+
+  p = mmap(NULL, sz + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED) return NULL;
+
+  // Trim the mapping so it starts and ends on a huge page boundary
+  aligned = (char *)(((unsigned long)p + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+  head = aligned - p;
+  if(head > 0) munmap(p, head);
+  munmap(aligned + sz, HUGE_PAGE_SIZE - head);
+
+  // If THP is unavailable the mapping is still usable with normal pages
+  madvise(aligned, sz, MADV_HUGEPAGE);
+
+  return aligned;
+}
+
+// Allocates an array that is backed with huge pages when requested, falling
+// back to hugetlbfs -> transparent huge pages -> malloc as each fails. A malloc
+// fallback is still listed, so huge_page_usage counts the pages it asked for.
+void *huge_malloc(size_t size)
+{
+  void *p = NULL;
+  size_t sz;
+
+  if(mode == HUGE_NONE || size < HUGE_PAGE_SIZE){
+    return malloc(size);
+  }
+
+  sz = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+  if(mode == HUGE_HUGETLBFS){
+    p = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED){
+      add_region(p, sz, TRUE);
+      return p;
+    }
+  }
+
+  p = map_thp(sz);
+  if(p != NULL){
+    add_region(p, sz, TRUE);
+    return p;
+  }
+
+  p = malloc(size);
+  if(p != NULL){
+    add_region(p, sz, FALSE);
+  }
+
+  return p;
+}
+
+void *huge_calloc(size_t n, size_t size)
+{
+  void *p;
+
+  if(mode == HUGE_NONE || n*size < HUGE_PAGE_SIZE){
+    return calloc(n, size);
+  }
+
+  // Anonymous mappings are already zeroed, but a malloc fallback is not
+  p = huge_malloc(n*size);
+  if(p != NULL && !huge_mapped(p)){
+    memset(p, 0, n*size);
+  }
+
+  return p;
+}
+
+void *huge_realloc(void *ptr, size_t old_size, size_t size)
+{
+  void *p;
+
+  if(ptr == NULL) return huge_malloc(size);
+
+  if(!huge_tracked(ptr) && (mode == HUGE_NONE || size < HUGE_PAGE_SIZE)){
+    return realloc(ptr, size);
+  }
+
+  p = huge_malloc(size);
+  if(p != NULL){
+    memcpy(p, ptr, old_size < size ? old_size : size);
+    huge_free(ptr);
+  }
+
+  return p;
+}
+
+void huge_free(void *ptr)
+{
+  size_t sz;
+
+  if(ptr == NULL) return;
+
+  sz = remove_region(ptr);
+  if(sz > 0){
+    munmap(ptr, sz);
+  }
+  else{
+    free(ptr);
+  }
+
+  return;
+}
+
+// Whether ptr was mapped by huge_malloc
+int huge_mapped(void *ptr)
+{
+  int i;
+  int mapped = FALSE;
+
+  pthread_mutex_lock(&lock);
+  for(i=0; i<n_regions; i++){
+    if(regions[i].ptr == ptr){
+      mapped = regions[i].mapped;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  return mapped;
+}
+
+// Counts the huge pages backing the mapped arrays, by reading the kernel's view
+// in /proc/self/smaps, and the number of huge pages requested, including those
+// of arrays that fell back to malloc
+void huge_page_usage(unsigned long *n_huge, unsigned long *n_total)
+{
+  int i;
+  int in_region = FALSE;
+  char line[256];
+  unsigned long start, end, kb;
+  FILE *fp;
+
+  *n_huge = 0;
+  *n_total = 0;
+
+  pthread_mutex_lock(&lock);
+
+  for(i=0; i<n_regions; i++){
+    *n_total += regions[i].sz/HUGE_PAGE_SIZE;
+  }
+
+  fp = fopen("/proc/self/smaps", "r");
+  if(fp != NULL){
+    while(fgets(line, sizeof(line), fp) != NULL){
+
+      // Header line of a mapping: check whether it overlaps a mapped array.
+      // Adjacent arrays may have been merged into one mapping by the kernel.
+      if(sscanf(line, "%lx-%lx ", &start, &end) == 2){
+        in_region = FALSE;
+        for(i=0; i<n_regions; i++){
+          if(regions[i].mapped == TRUE && start < (unsigned long)regions[i].ptr + regions[i].sz &&
+             end > (unsigned long)regions[i].ptr){
+            in_region = TRUE;
+          }
+        }
+      }
+      else if(in_region == TRUE &&
+         (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+          sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1)){
+        *n_huge += kb*1024/HUGE_PAGE_SIZE;
+      }
+    }
+    fclose(fp);
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return;
+}
+
+// Creates an empty scratch arena. Scratch arrays are handed out of one block
+// by bumping an offset and released all at once with arena_reset, so scratch
+// that is reused every generation costs no allocator calls.
+Arena *init_arena(void)
+{
+  Arena *a = malloc(sizeof(Arena));
+
+  a->p = NULL;
+  a->sz = 0;
+  a->used = 0;
+  a->peak = 0;
+
+  return a;
+}
+
+// Makes sure the arena holds at least size bytes. The block is written once so
+// its pages are faulted in by the calling thread up front rather than during
+// the run.
+void arena_reserve(Arena *a, size_t size)
+{
+  if(size <= a->sz) return;
+
+  huge_free(a->p);
+  a->p = huge_malloc(size);
+  if(a->p == NULL){
+    print_error("Couldn't allocate scratch arena.");
+  }
+  memset(a->p, 0, size);
+  a->sz = size;
+  a->used = 0;
+
+  return;
+}
+
+// Hands out size bytes from the arena, aligned to a cache line. The contents
+// are left over from earlier use, so callers clear what they need.
+void *arena_alloc(Arena *a, size_t size)
+{
+  void *p;
+
+  size = (size + 63) & ~(size_t)63;
+
+  if(a->used + size > a->sz){
+    if(a->used > 0){
+      print_error("Scratch arena exhausted.");
+    }
+    arena_reserve(a, size);
+  }
+
+  p = a->p + a->used;
+  a->used += size;
+  if(a->used > a->peak) a->peak = a->used;
+
+  return p;
+}
+
+// Releases everything handed out from the arena
+void arena_reset(Arena *a)
+{
+  a->used = 0;
+
+  return;
+}
+
+void free_arena(Arena *a)
+{
+  huge_free(a->p);
+  free(a);
+
+  return;
+}
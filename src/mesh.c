@@ -0,0 +1,427 @@
+#include "simple_mc.h"
+#include<limits.h>
+
+// Maximum number of tets in a BVH leaf
+#define BVH_LEAF 4
+
+// Vertices of each face of a positively oriented tet, ordered so the face
+// normal points out of the tet. Face i is opposite vertex i.
+static const int FACES[4][3] = {{1, 2, 3}, {0, 3, 2}, {0, 1, 3}, {0, 2, 1}};
+
+// A face of a tet, used to match up neighbors
+typedef struct Face_{
+  long v[3]; // sorted node indices
+  long tet;
+  int face;
+} Face;
+
+static double *node(Mesh *m, long tet, int i)
+{
+  return &(m->nodes[3*m->tets[4*tet+i]]);
+}
+
+// Six times the signed volume of tet (a, b, c, d)
+static double orient(double *a, double *b, double *c, double *d)
+{
+  double ab[3] = {b[0]-a[0], b[1]-a[1], b[2]-a[2]};
+  double ac[3] = {c[0]-a[0], c[1]-a[1], c[2]-a[2]};
+  double ad[3] = {d[0]-a[0], d[1]-a[1], d[2]-a[2]};
+
+  return (ab[1]*ac[2] - ab[2]*ac[1])*ad[0] + (ab[2]*ac[0] - ab[0]*ac[2])*ad[1] +
+     (ab[0]*ac[1] - ab[1]*ac[0])*ad[2];
+}
+
+static int compare_faces(const void *a, const void *b)
+{
+  int i;
+  const Face *fa = a;
+  const Face *fb = b;
+
+  for(i=0; i<3; i++){
+    if(fa->v[i] < fb->v[i]) return -1;
+    if(fa->v[i] > fb->v[i]) return 1;
+  }
+  return 0;
+}
+
+// Finds the tet across each face by sorting all faces on their nodes, so that
+// the two copies of an interior face end up next to each other
+static void build_adjacency(Mesh *m)
+{
+  long i, t;
+  int f, j, k;
+  long tmp;
+  Face *faces = malloc(4*m->n_tets*sizeof(Face));
+
+  for(t=0; t<m->n_tets; t++){
+    for(f=0; f<4; f++){
+      Face *face = &(faces[4*t+f]);
+      for(j=0; j<3; j++){
+        face->v[j] = m->tets[4*t+FACES[f][j]];
+      }
+      for(j=0; j<2; j++){
+        for(k=0; k<2-j; k++){
+          if(face->v[k] > face->v[k+1]){
+            tmp = face->v[k];
+            face->v[k] = face->v[k+1];
+            face->v[k+1] = tmp;
+          }
+        }
+      }
+      face->tet = t;
+      face->face = f;
+      m->neighbor[4*t+f] = -1;
+    }
+  }
+
+  qsort(faces, 4*m->n_tets, sizeof(Face), compare_faces);
+
+  for(i=0; i+1<4*m->n_tets; i++){
+    if(compare_faces(&(faces[i]), &(faces[i+1])) == 0){
+      m->neighbor[4*faces[i].tet + faces[i].face] = 4*faces[i+1].tet + faces[i+1].face;
+      m->neighbor[4*faces[i+1].tet + faces[i+1].face] = 4*faces[i].tet + faces[i].face;
+      i++;
+    }
+  }
+
+  free(faces);
+
+  return;
+}
+
+// Axis used to order tets while building the BVH
+static int sort_axis;
+static double *sort_centroids;
+
+static int compare_centroids(const void *a, const void *b)
+{
+  double ca = sort_centroids[3*(*(const long *)a) + sort_axis];
+  double cb = sort_centroids[3*(*(const long *)b) + sort_axis];
+
+  return (ca > cb) - (ca < cb);
+}
+
+// Builds the subtree over tets bvh_tets[first:first+n] and returns its node
+static long build_bvh(Mesh *m, double *centroids, long first, long n)
+{
+  long i, j, l;
+  int k, axis;
+  double c_lo[3] = {D_INF, D_INF, D_INF};
+  double c_hi[3] = {-D_INF, -D_INF, -D_INF};
+  BVHNode *b;
+
+  l = m->n_bvh++;
+  b = &(m->bvh[l]);
+
+  // Bounds of the tets and of their centroids
+  for(k=0; k<3; k++){
+    b->lo[k] = D_INF;
+    b->hi[k] = -D_INF;
+  }
+  for(i=first; i<first+n; i++){
+    for(j=0; j<4; j++){
+      double *x = node(m, m->bvh_tets[i], j);
+      for(k=0; k<3; k++){
+        if(x[k] < b->lo[k]) b->lo[k] = x[k];
+        if(x[k] > b->hi[k]) b->hi[k] = x[k];
+      }
+    }
+    for(k=0; k<3; k++){
+      double c = centroids[3*m->bvh_tets[i]+k];
+      if(c < c_lo[k]) c_lo[k] = c;
+      if(c > c_hi[k]) c_hi[k] = c;
+    }
+  }
+
+  if(n <= BVH_LEAF){
+    b->first = first;
+    b->n = n;
+    return l;
+  }
+
+  // Split at the median centroid along the longest axis
+  axis = 0;
+  for(k=1; k<3; k++){
+    if(c_hi[k] - c_lo[k] > c_hi[axis] - c_lo[axis]) axis = k;
+  }
+  sort_axis = axis;
+  sort_centroids = centroids;
+  qsort(&(m->bvh_tets[first]), n, sizeof(long), compare_centroids);
+
+  b->n = 0;
+  build_bvh(m, centroids, first, n/2);
+  b = &(m->bvh[l]);
+  b->first = build_bvh(m, centroids, first + n/2, n - n/2);
+
+  return l;
+}
+
+// Reads an unstructured tetrahedral mesh from a binary file laid out as
+//   int64 n_nodes, int64 n_tets, int32 n_materials
+//   double xs[n_materials][3]   fission, absorption and scattering macro xs
+//   double nodes[n_nodes][3]
+//   int64 tets[n_tets][4]       node indices
+//   int32 material[n_tets]      material index
+// The mesh is translated so that its bounding box starts at the origin.
+Mesh *load_mesh(char *filename)
+{
+  long i, t;
+  int k, n_read = 0;
+  double lo[3] = {D_INF, D_INF, D_INF};
+  double *centroids;
+  double v;
+  long tmp;
+  FILE *fp;
+  Mesh *m = malloc(sizeof(Mesh));
+
+  fp = fopen(filename, "rb");
+  if(fp == NULL){
+    print_error("Couldn't open mesh file.");
+  }
+
+  n_read += fread(&(m->n_nodes), sizeof(long), 1, fp);
+  n_read += fread(&(m->n_tets), sizeof(long), 1, fp);
+  n_read += fread(&(m->n_materials), sizeof(int), 1, fp);
+  if(n_read != 3 || m->n_nodes < 4 || m->n_tets < 1 || m->n_materials < 1){
+    print_error("Invalid mesh file header.");
+  }
+  if(m->n_tets > MAX_TETS){
+    print_error("Mesh has more tets than a particle can index (2^31 - 1).");
+  }
+
+  m->xs = malloc(3*m->n_materials*sizeof(double));
+  m->nodes = malloc(3*m->n_nodes*sizeof(double));
+  m->tets = malloc(4*m->n_tets*sizeof(long));
+  m->material = malloc(m->n_tets*sizeof(int));
+  if(fread(m->xs, sizeof(double), 3*m->n_materials, fp) != 3*m->n_materials ||
+     fread(m->nodes, sizeof(double), 3*m->n_nodes, fp) != 3*m->n_nodes ||
+     fread(m->tets, sizeof(long), 4*m->n_tets, fp) != 4*m->n_tets ||
+     fread(m->material, sizeof(int), m->n_tets, fp) != m->n_tets){
+    print_error("Error loading mesh.");
+  }
+  fclose(fp);
+
+  for(t=0; t<m->n_tets; t++){
+    for(k=0; k<4; k++){
+      if(m->tets[4*t+k] < 0 || m->tets[4*t+k] >= m->n_nodes)
+        print_error("Mesh tet references a node that does not exist");
+    }
+    if(m->material[t] < 0 || m->material[t] >= m->n_materials)
+      print_error("Mesh tet references a material that does not exist");
+  }
+
+  // Translate the mesh to start at the origin
+  for(i=0; i<m->n_nodes; i++){
+    for(k=0; k<3; k++){
+      if(m->nodes[3*i+k] < lo[k]) lo[k] = m->nodes[3*i+k];
+    }
+  }
+  for(k=0; k<3; k++){
+    m->L[k] = 0;
+  }
+  for(i=0; i<m->n_nodes; i++){
+    for(k=0; k<3; k++){
+      m->nodes[3*i+k] -= lo[k];
+      if(m->nodes[3*i+k] > m->L[k]) m->L[k] = m->nodes[3*i+k];
+    }
+  }
+
+  // Orient every tet positively and store its volume
+  m->volume = malloc(m->n_tets*sizeof(double));
+  for(t=0; t<m->n_tets; t++){
+    v = orient(node(m, t, 0), node(m, t, 1), node(m, t, 2), node(m, t, 3));
+    if(v < 0){
+      tmp = m->tets[4*t+2];
+      m->tets[4*t+2] = m->tets[4*t+3];
+      m->tets[4*t+3] = tmp;
+      v = -v;
+    }
+    if(v == 0){
+      print_error("Mesh contains a degenerate tet");
+    }
+    m->volume[t] = v/6;
+  }
+
+  m->neighbor = malloc(4*m->n_tets*sizeof(long));
+  build_adjacency(m);
+
+  // Build the BVH used to locate points in the mesh
+  centroids = malloc(3*m->n_tets*sizeof(double));
+  m->bvh_tets = malloc(m->n_tets*sizeof(long));
+  for(t=0; t<m->n_tets; t++){
+    m->bvh_tets[t] = t;
+    for(k=0; k<3; k++){
+      centroids[3*t+k] = 0.25*(node(m, t, 0)[k] + node(m, t, 1)[k] +
+         node(m, t, 2)[k] + node(m, t, 3)[k]);
+    }
+  }
+  m->bvh = malloc(2*m->n_tets*sizeof(BVHNode));
+  m->n_bvh = 0;
+  build_bvh(m, centroids, 0, m->n_tets);
+  free(centroids);
+
+  return m;
+}
+
+// Returns the tet containing point x, or -1 if it is outside the mesh
+long locate_tet(Mesh *m, double *x)
+{
+  long stack[128];
+  int n_stack = 0;
+  long i, t;
+  int k, inside;
+  BVHNode *b;
+
+  stack[n_stack++] = 0;
+  while(n_stack > 0){
+    b = &(m->bvh[stack[--n_stack]]);
+
+    inside = TRUE;
+    for(k=0; k<3; k++){
+      if(x[k] < b->lo[k] || x[k] > b->hi[k]) inside = FALSE;
+    }
+    if(inside == FALSE) continue;
+
+    // Interior node: its left child directly follows it
+    if(b->n == 0){
+      stack[n_stack++] = b->first;
+      stack[n_stack++] = b - m->bvh + 1;
+      continue;
+    }
+
+    for(i=b->first; i<b->first+b->n; i++){
+      t = m->bvh_tets[i];
+      if(orient(x, node(m, t, 1), node(m, t, 2), node(m, t, 3)) >= 0 &&
+         orient(node(m, t, 0), x, node(m, t, 2), node(m, t, 3)) >= 0 &&
+         orient(node(m, t, 0), node(m, t, 1), x, node(m, t, 3)) >= 0 &&
+         orient(node(m, t, 0), node(m, t, 1), node(m, t, 2), x) >= 0){
+        return t;
+      }
+    }
+  }
+
+  return -1;
+}
+
+// Returns the distance to the face the particle leaves its tet through. The
+// Plucker product of the ray with each edge tells which side of the edge the
+// ray passes; the exit face is the one whose edges the ray all passes on the
+// positive side, and the products are the barycentric weights of the exit
+// point on that face.
+double distance_to_tet_face(Mesh *m, Particle *p)
+{
+  int f, j, a, b, c;
+  int exit = 0;
+  double side[4][4];
+  double best = -D_INF;
+  double w, w_sum, d;
+  double o[3] = {p->x, p->y, p->z};
+  double u[3] = {p->u, p->v, p->w};
+  double oxu[3] = {o[1]*u[2] - o[2]*u[1], o[2]*u[0] - o[0]*u[2], o[0]*u[1] - o[1]*u[0]};
+  double x[3];
+  double *v[4];
+
+  for(j=0; j<4; j++){
+    v[j] = node(m, p->cell, j);
+  }
+
+  // Side of the ray for each of the six edges a->b
+  for(a=0; a<4; a++){
+    for(b=a+1; b<4; b++){
+      double e[3] = {v[b][0]-v[a][0], v[b][1]-v[a][1], v[b][2]-v[a][2]};
+      double axb[3] = {v[a][1]*v[b][2] - v[a][2]*v[b][1],
+         v[a][2]*v[b][0] - v[a][0]*v[b][2], v[a][0]*v[b][1] - v[a][1]*v[b][0]};
+      side[a][b] = u[0]*axb[0] + u[1]*axb[1] + u[2]*axb[2] +
+         e[0]*oxu[0] + e[1]*oxu[1] + e[2]*oxu[2];
+      side[b][a] = -side[a][b];
+    }
+  }
+
+  // Pick the face whose smallest edge product is largest; for a ray that is
+  // not grazing an edge this is the only face with all products positive
+  for(f=0; f<4; f++){
+    a = FACES[f][0];
+    b = FACES[f][1];
+    c = FACES[f][2];
+    w = side[a][b];
+    if(side[b][c] < w) w = side[b][c];
+    if(side[c][a] < w) w = side[c][a];
+    if(w > best){
+      best = w;
+      exit = f;
+    }
+  }
+
+  // Exit point from the barycentric weights on the exit face
+  a = FACES[exit][0];
+  b = FACES[exit][1];
+  c = FACES[exit][2];
+  w_sum = side[b][c] + side[c][a] + side[a][b];
+  if(w_sum <= 0){
+    d = 0;
+  }
+  else{
+    for(j=0; j<3; j++){
+      x[j] = (side[b][c]*v[a][j] + side[c][a]*v[b][j] + side[a][b]*v[c][j])/w_sum;
+    }
+    d = (x[0]-o[0])*u[0] + (x[1]-o[1])*u[1] + (x[2]-o[2])*u[2];
+    if(d < 0) d = 0;
+  }
+
+  p->surface_crossed = exit;
+
+  return d;
+}
+
+// Moves a particle across the face it reached into the neighboring tet, or
+// applies the boundary condition if the face is on the boundary of the mesh
+void cross_tet_face(Geometry *geometry, Particle *p)
+{
+  Mesh *m = geometry->mesh;
+  int f = p->surface_crossed;
+  long next = m->neighbor[4*p->cell + f];
+  double *a, *b, *c;
+  double n[3], len, un;
+
+  if(next >= 0){
+    p->cell = next/4;
+    return;
+  }
+
+  if(geometry->bc == VACUUM){
+    p->alive = FALSE;
+  }
+
+  // Reflect the direction about the face normal
+  else if(geometry->bc == REFLECT){
+    a = node(m, p->cell, FACES[f][0]);
+    b = node(m, p->cell, FACES[f][1]);
+    c = node(m, p->cell, FACES[f][2]);
+    n[0] = (b[1]-a[1])*(c[2]-a[2]) - (b[2]-a[2])*(c[1]-a[1]);
+    n[1] = (b[2]-a[2])*(c[0]-a[0]) - (b[0]-a[0])*(c[2]-a[2]);
+    n[2] = (b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0]);
+    len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    un = (p->u*n[0] + p->v*n[1] + p->w*n[2])/len;
+    p->u -= 2*un*n[0]/len;
+    p->v -= 2*un*n[1]/len;
+    p->w -= 2*un*n[2]/len;
+  }
+
+  return;
+}
+
+void free_mesh(Mesh *m)
+{
+  free(m->xs);
+  free(m->nodes);
+  free(m->tets);
+  free(m->material);
+  free(m->volume);
+  free(m->neighbor);
+  free(m->bvh);
+  free(m->bvh_tets);
+  free(m);
+  m = NULL;
+
+  return;
+}
@@ -0,0 +1,143 @@
+#include "simple_mc.h"
+#include<dlfcn.h>
+
+// Looks up a function the plugin must define
+static void *plugin_symbol(void *handle, char *name)
+{
+  char message[256];
+  void *f = dlsym(handle, name);
+
+  if(f == NULL){
+    snprintf(message, sizeof(message), "Source plugin doesn't define '%s'", name);
+    print_error(message);
+  }
+
+  return f;
+}
+
+Source_Plugin *load_source_plugin(Parameters *parameters, Geometry *geometry)
+{
+  char message[512];
+  int (*version)(void);
+  int (*init)(const char *args, const double *L, void **state);
+  double L[3] = {geometry->Lx, geometry->Ly, geometry->Lz};
+  double *buffer;
+  unsigned long n = parameters->source_chunk;
+  Source_Plugin *sp = malloc(sizeof(Source_Plugin));
+
+  sp->handle = dlopen(parameters->source_plugin, RTLD_NOW | RTLD_LOCAL);
+  if(sp->handle == NULL){
+    snprintf(message, sizeof(message), "Couldn't load source plugin: %s", dlerror());
+    print_error(message);
+  }
+
+  version = plugin_symbol(sp->handle, "source_version");
+  if(version() != SOURCE_PLUGIN_VERSION){
+    print_error("Source plugin was built against a different source_plugin.h");
+  }
+  init = plugin_symbol(sp->handle, "source_init");
+  sp->sample = plugin_symbol(sp->handle, "source_sample");
+  sp->free = plugin_symbol(sp->handle, "source_free");
+
+  sp->state = NULL;
+  if(init(parameters->source_plugin_args, L, &(sp->state)) != 0){
+    print_error("Source plugin failed to initialize");
+  }
+
+  // One block holds the eight arrays of a chunk
+  buffer = malloc(8*n*sizeof(double));
+  sp->sites.seed = malloc(n*sizeof(unsigned long long));
+  sp->sites.x = buffer;
+  sp->sites.y = buffer + n;
+  sp->sites.z = buffer + 2*n;
+  sp->sites.u = buffer + 3*n;
+  sp->sites.v = buffer + 4*n;
+  sp->sites.w = buffer + 5*n;
+  sp->sites.energy = buffer + 6*n;
+  sp->sites.weight = buffer + 7*n;
+  sp->chunk = n;
+  sp->n_sampled = 0;
+  sp->t_sample = 0;
+
+  return sp;
+}
+
+// Fills the bank with n source particles from the plugin, which are the sites
+// first to first+n-1 of the run. Each site's substream starts where rn_skip
+// puts it in the STREAM_SOURCE random number sequence, so the other sequences
+// are unaffected.
+void sample_plugin_source(Source_Plugin *sp, Geometry *geometry, unsigned long first, unsigned long n, Bank *b)
+{
+  unsigned long i, j, m;
+  double norm, t;
+  double x[3];
+  Source_Sites *s = &(sp->sites);
+  Particle *p;
+
+  while(b->sz < n){
+    b->resize(b);
+  }
+
+  set_stream(STREAM_SOURCE);
+
+  for(j=0; j<n; j+=m){
+    m = n - j < sp->chunk ? n - j : sp->chunk;
+    s->n = m;
+    rn_skip_seeds(first + j, m, s->seed);
+
+    t = timer();
+    if(sp->sample(sp->state, s) != 0){
+      print_error("Source plugin failed to sample sites");
+    }
+    sp->t_sample += timer() - t;
+    sp->n_sampled += m;
+
+    for(i=0; i<m; i++){
+      p = &(b->p[j+i]);
+      norm = sqrt(s->u[i]*s->u[i] + s->v[i]*s->v[i] + s->w[i]*s->w[i]);
+      if(norm == 0 || !(s->weight[i] > 0)){
+        print_error("Source plugin site has no direction or a nonpositive weight");
+      }
+      p->x = s->x[i];
+      p->y = s->y[i];
+      p->z = s->z[i];
+      p->u = s->u[i]/norm;
+      p->v = s->v[i]/norm;
+      p->w = s->w[i]/norm;
+      p->weight = s->weight[i];
+      p->alive = TRUE;
+      p->force = TRUE;
+
+      // Sites may lie on the boundary, so locate them in the mesh a little
+      // way along their direction
+      if(geometry->type == TET_MESH){
+        x[0] = p->x + 1.0e-9*p->u;
+        x[1] = p->y + 1.0e-9*p->v;
+        x[2] = p->z + 1.0e-9*p->w;
+        if((p->cell = locate_tet(geometry->mesh, x)) < 0){
+          print_error("Source plugin site lies outside the mesh");
+        }
+      }
+      else if(p->x < 0 || p->x > geometry->Lx || p->y < 0 || p->y > geometry->Ly ||
+         p->z < 0 || p->z > geometry->Lz){
+        print_error("Source plugin site lies outside the box");
+      }
+    }
+  }
+  b->n = n;
+
+  set_stream(STREAM_OTHER);
+
+  return;
+}
+
+void free_source_plugin(Source_Plugin *sp)
+{
+  sp->free(sp->state);
+  dlclose(sp->handle);
+  free(sp->sites.x);
+  free(sp->sites.seed);
+  free(sp);
+
+  return;
+}
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "simple_mc.h"
+#include<sched.h>
+#include<limits.h>
+#include<linux/futex.h>
+#include<sys/syscall.h>
+
+// Number of times a parked thread polls before sleeping on the futex
+#define N_SPIN 4096
+
+static void futex_wait(int *addr, int val)
+{
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int *addr, int n)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+// Pins the calling thread to the id-th cpu it is allowed to run on
+static void pin_thread(int id)
+{
+  int i, j = 0, n;
+  cpu_set_t allowed, set;
+
+  if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) return;
+  n = CPU_COUNT(&allowed);
+  if(n < 1) return;
+
+  for(i=0; i<CPU_SETSIZE; i++){
+    if(CPU_ISSET(i, &allowed)){
+      if(j == id % n){
+        CPU_ZERO(&set);
+        CPU_SET(i, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+        return;
+      }
+      j++;
+    }
+  }
+
+  return;
+}
+
+// Waits until the value at addr differs from val, spinning briefly before
+// parking on the futex
+static int wait_while_equal(int *addr, int val, int n_spin)
+{
+  int i, cur;
+
+  for(i=0; i<n_spin; i++){
+    cur = __atomic_load_n(addr, __ATOMIC_ACQUIRE);
+    if(cur != val) return cur;
+  }
+  while((cur = __atomic_load_n(addr, __ATOMIC_ACQUIRE)) == val){
+    futex_wait(addr, val);
+  }
+
+  return cur;
+}
+
+static void *worker(void *arg)
+{
+  Pool *pool = arg;
+  int id;
+  int phase = 0;
+  double t;
+
+  id = __atomic_add_fetch(&pool->n_started, 1, __ATOMIC_ACQ_REL);
+  if(pool->pin == TRUE){
+    pin_thread(id);
+  }
+  profile_thread();
+
+  while(1){
+
+    // Park until the main thread releases the next phase
+    phase = wait_while_equal(&pool->phase, phase, pool->n_spin);
+    if(pool->shutdown == TRUE) break;
+
+    t = timer();
+    pool->task(pool->arg, id);
+    pool->busy[id] = timer() - t;
+
+    // Arrive at the barrier; the last thread in wakes the main thread
+    if(__atomic_sub_fetch(&pool->running, 1, __ATOMIC_ACQ_REL) == 0){
+      futex_wake(&pool->running, 1);
+    }
+  }
+
+  return NULL;
+}
+
+// Creates the pool once for the whole run. The calling thread acts as thread
+// 0, so n_threads-1 workers are started.
+Pool *init_pool(Parameters *parameters)
+{
+  int i;
+  cpu_set_t allowed;
+  Pool *pool = malloc(sizeof(Pool));
+
+  pool->n_threads = parameters->n_threads;
+  pool->pin = parameters->pin_threads;
+  pool->task = NULL;
+  pool->arg = NULL;
+  pool->phase = 0;
+  pool->running = 0;
+  pool->shutdown = FALSE;
+  pool->n_started = 0;
+  pool->busy = calloc(pool->n_threads, sizeof(double));
+  pool->n_dispatch = 0;
+  pool->t_dispatch = 0;
+  pool->n_histories = 0;
+  pool->n_generations = 0;
+  pool->threads = malloc(pool->n_threads*sizeof(pthread_t));
+  pool->scratch = init_arena();
+
+  // Spinning only helps when every thread has a core to itself
+  pool->n_spin = 0;
+  if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0 &&
+     CPU_COUNT(&allowed) >= pool->n_threads){
+    pool->n_spin = N_SPIN;
+  }
+
+  if(pool->pin == TRUE && pool->n_threads > 1){
+    pin_thread(0);
+  }
+
+  for(i=1; i<pool->n_threads; i++){
+    if(pthread_create(&(pool->threads[i]), NULL, worker, pool) != 0){
+      print_error("Couldn't create worker thread.");
+    }
+  }
+
+  return pool;
+}
+
+// Runs task(arg, id) on every thread in the pool and returns once all threads
+// have finished. The time not spent inside the slowest task is accumulated as
+// dispatch overhead.
+void pool_run(Pool *pool, void (*task)(void *arg, int id), void *arg)
+{
+  int i;
+  int running;
+  double t0, t;
+  double busy_max;
+
+  t0 = timer();
+
+  if(pool->n_threads > 1){
+    pool->task = task;
+    pool->arg = arg;
+    __atomic_store_n(&pool->running, pool->n_threads - 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&pool->phase, 1, __ATOMIC_ACQ_REL);
+    futex_wake(&pool->phase, INT_MAX);
+  }
+
+  // Main thread does its share of the work
+  t = timer();
+  task(arg, 0);
+  pool->busy[0] = timer() - t;
+
+  // Wait for the rest of the pool
+  if(pool->n_threads > 1){
+    while((running = __atomic_load_n(&pool->running, __ATOMIC_ACQUIRE)) != 0){
+      wait_while_equal(&pool->running, running, pool->n_spin);
+    }
+  }
+
+  busy_max = 0;
+  for(i=0; i<pool->n_threads; i++){
+    if(pool->busy[i] > busy_max) busy_max = pool->busy[i];
+  }
+  pool->t_dispatch += timer() - t0 - busy_max;
+  pool->n_dispatch++;
+
+  return;
+}
+
+void free_pool(Pool *pool)
+{
+  int i;
+
+  if(pool->n_threads > 1){
+    pool->shutdown = TRUE;
+    __atomic_add_fetch(&pool->phase, 1, __ATOMIC_ACQ_REL);
+    futex_wake(&pool->phase, INT_MAX);
+    for(i=1; i<pool->n_threads; i++){
+      pthread_join(pool->threads[i], NULL);
+    }
+  }
+
+  free_arena(pool->scratch);
+  free(pool->threads);
+  free(pool->busy);
+  free(pool);
+
+  return;
+}
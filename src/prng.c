@@ -11,12 +11,14 @@ typedef struct RNG_Parameters_{
 
 // LCG parameters from 'The MCNP5 Random Number Generator', Forrest Brown
 // Additional mult for M=63: 2806196910506780709ULL  3249286849523012805ULL
-static const RNG_Parameters RNG = {19073486328125ULL, 281474976710656ULL, 1ULL, 152917, 281474976710655ULL, 70368744177664ULL}; // period 2^46
+static const RNG_Parameters RNG = {19073486328125ULL, 281474976710656ULL, 1ULL, 152917, 281474976710655ULL, 281474976710656ULL}; // period 2^48
 //static const RNG_Parameters RNG = {9219741426499971445ULL, 9223372036854775808ULL, 1ULL, 152917, 9223372036854775807ULL, 9223372036854775808ULL}; // period 2^63
 
-int stream;
+// The initial seeds are shared, while each thread keeps its own stream and
+// current seeds
+__thread int stream;
 unsigned long long seed0[N_STREAMS];
-unsigned long long seed[N_STREAMS];
+__thread unsigned long long seed[N_STREAMS];
 
 // Linear congruential random number generator: seed = (mult*seed + inc) % mod
 double rn(void)
@@ -26,12 +28,42 @@ double rn(void)
   return (double) seed[stream]/RNG.mod;
 }
 
-// Linear congruential random number generator for integer in range [a b)
-int rni(int a, int b)
+// Next raw output of the LCG, a uniform integer in [0, RNG.mod)
+static unsigned long long next_seed(void)
 {
   seed[stream] = (RNG.mult*seed[stream] + RNG.inc) & RNG.mask;
 
-  return a + (int) (b*seed[stream]/(RNG.mod + a));
+  return seed[stream];
+}
+
+// Unbiased random integer in range [a b), using Lemire's multiply-and-reject
+// method. A single M-bit draw covers ranges up to the modulus; wider ranges
+// use a 64-bit value built from the high 32 bits of two draws. The rejection
+// step only triggers when the low product falls in the biased sliver of size
+// (2^bits mod range), so for small ranges the result is floor(range*rn()).
+unsigned long rni(unsigned long a, unsigned long b)
+{
+  unsigned long long r = b - a;
+  unsigned long long x, l, t;
+  unsigned __int128 m;
+  int bits = __builtin_ctzll(RNG.mod);
+  int wide = r > RNG.mod;
+
+  do{
+    if(wide){
+      x = next_seed() >> (bits - 32) << 32;
+      x |= next_seed() >> (bits - 32);
+    }
+    else{
+      x = next_seed();
+    }
+    m = (unsigned __int128) x*r;
+    l = wide ? (unsigned long long) m : (unsigned long long) m & RNG.mask;
+    if(l >= r) break;
+    t = wide ? -r % r : (RNG.mod - r) % r;
+  } while(l < t);
+
+  return a + (unsigned long)(m >> (wide ? 64 : bits));
 }
 
 // Set random number stream
@@ -42,6 +74,19 @@ void set_stream(int rn_stream)
   return;
 }
 
+// Current seed of the random number stream, to save and restore the sequence
+unsigned long long get_seed(void)
+{
+  return seed[stream];
+}
+
+void set_seed(unsigned long long rn_seed)
+{
+  seed[stream] = rn_seed;
+
+  return;
+}
+
 // Set inital seed for each random number sequence
 void set_initial_seed(unsigned long long rn_seed0)
 {
@@ -55,33 +100,58 @@ void set_initial_seed(unsigned long long rn_seed0)
   return;
 }
 
-// Algorithm to skip ahead n*RNG.stride random numbers in O(log2(n)) operation,
-// from 'The MCNP5 Random Number Generator', Forrest Brown, LA-UR-07K-7961.
-void rn_skip(long long n)
+// Finds the multiplier and increment that advance a seed by k random numbers,
+// seed -> (g_new*seed + c_new) % mod, in O(log2(k)) operations, from 'The MCNP5
+// Random Number Generator', Forrest Brown, LA-UR-07K-7961.
+static void skip_ahead(unsigned long long k, unsigned long long *g_new, unsigned long long *c_new)
 {
   unsigned long long g = RNG.mult;
   unsigned long long c = RNG.inc;
-  unsigned long long g_new = 1;
-  unsigned long long c_new = 0;
 
-  n *= RNG.stride;
-
-  // Add period until greater than 0
-  while(n < 0) n += RNG.period;
-
-  // n % mod
-  n = n & RNG.mask;
+  *g_new = 1;
+  *c_new = 0;
 
   // Get mult = mult^n in log2(n) operations
-  while(n > 0){
-    if(n & 1){
-      g_new = g_new*g & RNG.mask;
-      c_new = (c_new*g + c) & RNG.mask;
+  while(k > 0){
+    if(k & 1){
+      *g_new = *g_new*g & RNG.mask;
+      *c_new = (*c_new*g + c) & RNG.mask;
     }
     c = (c*g + c) & RNG.mask;
     g = g*g & RNG.mask;
-    n >>= 1;
+    k >>= 1;
   }
 
-  seed[stream] = (g_new*seed0[stream] + c_new) & RNG.mask;
+  return;
+}
+
+// Skips ahead n*RNG.stride random numbers from the initial seed of the stream
+void rn_skip(long long n)
+{
+  unsigned long long g, c;
+
+  // The scaled count wraps modulo 2^64, a multiple of the 2^48 modulus, so
+  // masking it gives n*stride modulo 2^48 for any particle count
+  skip_ahead((unsigned long long) n*RNG.stride & RNG.mask, &g, &c);
+
+  seed[stream] = (g*seed0[stream] + c) & RNG.mask;
+}
+
+// Fills seeds with the seeds rn_skip would set in the current stream for
+// particles first to first+n-1. Only the first is a full skip; each of the
+// others is one stride past the one before.
+void rn_skip_seeds(long long first, unsigned long n, unsigned long long *seeds)
+{
+  unsigned long i;
+  unsigned long long g, c, s;
+
+  rn_skip(first);
+  s = seed[stream];
+  skip_ahead(RNG.stride, &g, &c);
+  for(i=0; i<n; i++){
+    seeds[i] = s;
+    s = (g*s + c) & RNG.mask;
+  }
+
+  return;
 }
@@ -0,0 +1,412 @@
+#define _GNU_SOURCE
+#include "simple_mc.h"
+#include<dlfcn.h>
+#include<elf.h>
+#include<link.h>
+#include<stdint.h>
+#include<ucontext.h>
+#include<sys/syscall.h>
+
+// Sampling profiler. Each thread has a timer on its own cpu clock that sends
+// it SIGPROF profile_rate times a second of cpu time, and the handler records
+// the interrupted program counter with the phase the run is in. At exit the
+// program counters are symbolized from the symbol table of the executable, or
+// with dladdr() for shared libraries such as libm, and a flat profile is
+// printed.
+
+// Number of samples each thread can hold, over 15 minutes of cpu time at the
+// default rate
+#define MAX_SAMPLES (1 << 20)
+
+// Maximum number of threads profiled
+#define MAX_PROFILED 256
+
+// Functions shown in the flat profile
+#define N_SHOWN 30
+
+// Older glibc doesn't name the thread field of struct sigevent
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+typedef struct Profile_Thread_{
+  timer_t timer;
+  unsigned long n; // number of samples
+  unsigned long n_dropped; // samples lost once the buffer was full
+  uintptr_t *pc; // program counter of each sample
+  unsigned char *phase; // phase of each sample
+} Profile_Thread;
+
+// Function of the executable from its symbol table
+typedef struct Symbol_{
+  uintptr_t addr;
+  uintptr_t size;
+  char *name;
+} Symbol;
+
+// Samples attributed to one function
+typedef struct Profile_Entry_{
+  char *name;
+  const void *key; // identifies the function: its symbol, or its address in a library
+  unsigned long n;
+  unsigned long n_phase[N_PHASES];
+} Profile_Entry;
+
+// Phase the run is in, and the wall time and energy spent in each phase since
+// reset_phase_times()
+static volatile sig_atomic_t profile_phase = PHASE_OTHER;
+static double t_phase = 0;
+static double e_phase = 0;
+double phase_time[N_PHASES];
+double phase_energy[N_PHASES];
+
+const char *PHASE_NAMES[N_PHASES] = {"other", "transport", "sync", "entropy", "I/O"};
+
+static int profiling = FALSE;
+static double rate;
+static Profile_Thread *threads[MAX_PROFILED];
+static int n_profiled = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread Profile_Thread *self = NULL;
+
+// Records the interrupted program counter and phase. Only touches the
+// calling thread's preallocated buffer, so it is async-signal-safe.
+static void record_sample(int sig, siginfo_t *info, void *context)
+{
+  ucontext_t *uc = context;
+  Profile_Thread *t = self;
+  uintptr_t pc;
+
+  if(t == NULL) return;
+
+#if defined(__x86_64__)
+  pc = uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+  pc = uc->uc_mcontext.pc;
+#else
+  pc = 0;
+#endif
+
+  if(t->n < MAX_SAMPLES){
+    t->pc[t->n] = pc;
+    t->phase[t->n] = profile_phase;
+    t->n++;
+  }
+  else{
+    t->n_dropped++;
+  }
+
+  return;
+}
+
+// Moves the run to a new phase, charging the wall time and, with energy
+// counters, the package and DRAM energy since the last change to the phase it
+// leaves. Only the main thread changes phase.
+void set_phase(int phase)
+{
+  double t = timer();
+  double package, dram;
+
+  phase_time[profile_phase] += t - t_phase;
+  t_phase = t;
+  if(read_energy(&package, &dram) == TRUE){
+    phase_energy[profile_phase] += package + dram - e_phase;
+    e_phase = package + dram;
+  }
+  profile_phase = phase;
+
+  return;
+}
+
+void reset_phase_times(void)
+{
+  double package, dram;
+
+  memset(phase_time, 0, sizeof(phase_time));
+  memset(phase_energy, 0, sizeof(phase_energy));
+  t_phase = timer();
+  if(read_energy(&package, &dram) == TRUE){
+    e_phase = package + dram;
+  }
+
+  return;
+}
+
+// Starts sampling the calling thread. Does nothing unless the profiler is on.
+void profile_thread(void)
+{
+  Profile_Thread *t;
+  struct sigevent sev;
+  struct itimerspec its;
+  long ns = 1.0e9/rate;
+
+  if(profiling == FALSE || self != NULL) return;
+
+  t = calloc(1, sizeof(Profile_Thread));
+  t->pc = malloc(MAX_SAMPLES*sizeof(uintptr_t));
+  t->phase = malloc(MAX_SAMPLES*sizeof(unsigned char));
+
+  pthread_mutex_lock(&lock);
+  if(n_profiled == MAX_PROFILED){
+    pthread_mutex_unlock(&lock);
+    free(t->pc);
+    free(t->phase);
+    free(t);
+    return;
+  }
+  threads[n_profiled++] = t;
+  pthread_mutex_unlock(&lock);
+  self = t;
+
+  // A timer on the thread's cpu clock, signalling this thread
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_notify_thread_id = syscall(SYS_gettid);
+  if(timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &(t->timer)) != 0){
+    print_error("Couldn't create the profiling timer");
+  }
+  its.it_interval.tv_sec = ns/1000000000;
+  its.it_interval.tv_nsec = ns%1000000000;
+  its.it_value = its.it_interval;
+  timer_settime(t->timer, 0, &its, NULL);
+
+  return;
+}
+
+// Installs the SIGPROF handler and starts sampling the main thread; threads
+// of the pool start sampling themselves with profile_thread()
+void init_profiler(Parameters *parameters)
+{
+  struct sigaction sa;
+
+  if(parameters->profile == FALSE) return;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = record_sample;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigaction(SIGPROF, &sa, NULL);
+
+  rate = parameters->profile_rate;
+  profiling = TRUE;
+  profile_thread();
+
+  return;
+}
+
+// Load address of the executable, the first object dl_iterate_phdr() visits
+static int find_base(struct dl_phdr_info *info, size_t size, void *data)
+{
+  *(uintptr_t *)data = info->dlpi_addr;
+
+  return 1;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+  uintptr_t x = ((const Symbol *)a)->addr;
+  uintptr_t y = ((const Symbol *)b)->addr;
+
+  return (x > y) - (x < y);
+}
+
+// Reads the functions of the executable's symbol table, sorted by their
+// address in memory. Returns NULL if the executable is stripped.
+static Symbol *read_symbols(int *n)
+{
+  int i, j, n_sym;
+  long sz;
+  char *data;
+  uintptr_t base = 0;
+  FILE *fp;
+  Elf64_Ehdr *eh;
+  Elf64_Shdr *sh;
+  Elf64_Sym *sym;
+  Symbol *symbols = NULL;
+
+  *n = 0;
+  dl_iterate_phdr(find_base, &base);
+
+  fp = fopen("/proc/self/exe", "rb");
+  if(fp == NULL) return NULL;
+  fseek(fp, 0, SEEK_END);
+  sz = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  data = malloc(sz);
+  if(fread(data, 1, sz, fp) != sz){
+    fclose(fp);
+    free(data);
+    return NULL;
+  }
+  fclose(fp);
+
+  eh = (Elf64_Ehdr *)data;
+  if(memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64){
+    free(data);
+    return NULL;
+  }
+  sh = (Elf64_Shdr *)(data + eh->e_shoff);
+
+  for(i=0; i<eh->e_shnum; i++){
+    if(sh[i].sh_type != SHT_SYMTAB) continue;
+    sym = (Elf64_Sym *)(data + sh[i].sh_offset);
+    n_sym = sh[i].sh_size/sizeof(Elf64_Sym);
+    symbols = malloc(n_sym*sizeof(Symbol));
+    for(j=0; j<n_sym; j++){
+      if(ELF64_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_value == 0) continue;
+      symbols[*n].addr = base + sym[j].st_value;
+      symbols[*n].size = sym[j].st_size;
+      symbols[*n].name = strdup(data + sh[sh[i].sh_link].sh_offset + sym[j].st_name);
+      (*n)++;
+    }
+    break;
+  }
+  free(data);
+
+  if(symbols != NULL){
+    qsort(symbols, *n, sizeof(Symbol), compare_symbols);
+  }
+
+  return symbols;
+}
+
+// Function of the executable containing pc, or NULL
+static Symbol *find_symbol(Symbol *symbols, int n, uintptr_t pc)
+{
+  int lo = 0, hi = n - 1, mid;
+
+  while(lo <= hi){
+    mid = (lo + hi)/2;
+    if(symbols[mid].addr <= pc) lo = mid + 1;
+    else hi = mid - 1;
+  }
+  if(hi < 0 || pc >= symbols[hi].addr + (symbols[hi].size > 0 ? symbols[hi].size : 1)){
+    return NULL;
+  }
+
+  return &(symbols[hi]);
+}
+
+// Entry of the function with the given key, added if it isn't there yet
+static Profile_Entry *find_entry(Profile_Entry **entries, int *n, int *sz, const void *key, const char *name)
+{
+  int i;
+
+  for(i=0; i<*n; i++){
+    if((*entries)[i].key == key) return &((*entries)[i]);
+  }
+  if(*n == *sz){
+    *sz = *sz == 0 ? 64 : 2*(*sz);
+    *entries = realloc(*entries, (*sz)*sizeof(Profile_Entry));
+  }
+  memset(&((*entries)[*n]), 0, sizeof(Profile_Entry));
+  (*entries)[*n].key = key;
+  (*entries)[*n].name = strdup(name);
+
+  return &((*entries)[(*n)++]);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  unsigned long x = ((const Profile_Entry *)a)->n;
+  unsigned long y = ((const Profile_Entry *)b)->n;
+
+  return (x < y) - (x > y);
+}
+
+// Stops sampling and prints the samples in each phase and the flat profile of
+// the functions they fell in
+void print_profile(void)
+{
+  int i, k, n_symbols, n_entries = 0, sz = 0;
+  unsigned long j, n = 0, n_dropped = 0;
+  unsigned long n_phase[N_PHASES] = {0};
+  char name[256];
+  const char *lib;
+  Symbol *symbols, *s;
+  Profile_Entry *entries = NULL, *e;
+  Profile_Thread *t;
+  Dl_info info;
+
+  if(profiling == FALSE) return;
+
+  for(i=0; i<n_profiled; i++){
+    timer_delete(threads[i]->timer);
+  }
+  profiling = FALSE;
+
+  symbols = read_symbols(&n_symbols);
+
+  for(i=0; i<n_profiled; i++){
+    t = threads[i];
+    n += t->n;
+    n_dropped += t->n_dropped;
+    for(j=0; j<t->n; j++){
+      s = symbols != NULL ? find_symbol(symbols, n_symbols, t->pc[j]) : NULL;
+      if(s != NULL){
+        e = find_entry(&entries, &n_entries, &sz, s, s->name);
+      }
+      else if(dladdr((void *)t->pc[j], &info) != 0){
+        lib = strrchr(info.dli_fname, '/');
+        lib = lib != NULL ? lib + 1 : info.dli_fname;
+
+        // Internal functions of a library, such as the variants of log() in
+        // libm, aren't exported and are counted under the library
+        if(info.dli_sname != NULL){
+          snprintf(name, sizeof(name), "%s (%s)", info.dli_sname, lib);
+          e = find_entry(&entries, &n_entries, &sz, info.dli_saddr, name);
+        }
+        else{
+          snprintf(name, sizeof(name), "[%s]", lib);
+          e = find_entry(&entries, &n_entries, &sz, info.dli_fbase, name);
+        }
+      }
+      else{
+        e = find_entry(&entries, &n_entries, &sz, NULL, "[unknown]");
+      }
+      e->n++;
+      e->n_phase[t->phase[j]]++;
+      n_phase[t->phase[j]]++;
+    }
+  }
+
+  border_print();
+  center_print("PROFILE", 79);
+  border_print();
+  printf("Samples: %lu at %g Hz of cpu time on %d threads", n, rate, n_profiled);
+  if(n_dropped > 0) printf(" (%lu dropped)", n_dropped);
+  printf("\n");
+  if(n == 0) return;
+
+  printf("%-15s %10s %8s\n", "PHASE", "SAMPLES", "%");
+  for(k=0; k<N_PHASES; k++){
+    printf("%-15s %10lu %8.2f\n", PHASE_NAMES[k], n_phase[k], 100.0*n_phase[k]/n);
+  }
+  printf("\n");
+
+  qsort(entries, n_entries, sizeof(Profile_Entry), compare_entries);
+  printf("%-40s %10s %8s  %s\n", "FUNCTION", "SAMPLES", "%", "MAIN PHASE");
+  for(i=0; i<n_entries && i<N_SHOWN; i++){
+    e = &(entries[i]);
+    k = 0;
+    for(j=1; j<N_PHASES; j++){
+      if(e->n_phase[j] > e->n_phase[k]) k = j;
+    }
+    printf("%-40.40s %10lu %8.2f  %s\n", e->name, e->n, 100.0*e->n/n, PHASE_NAMES[k]);
+  }
+  if(n_entries > N_SHOWN){
+    printf("(%d more functions)\n", n_entries - N_SHOWN);
+  }
+
+  for(i=0; i<n_entries; i++){
+    free(entries[i].name);
+  }
+  free(entries);
+  for(i=0; i<n_symbols; i++){
+    free(symbols[i].name);
+  }
+  free(symbols);
+
+  return;
+}
@@ -0,0 +1,408 @@
+#include "simple_mc.h"
+
+// The random ray method solves the one-group transport equation with a flat
+// isotropic source in each cell of the tally mesh, or each tet of a tet mesh.
+// Each iteration traces n_particles rays from points sampled uniformly in the
+// domain in isotropic directions. A ray starts with the angular flux of the
+// source in its cell and first travels ray_dead_length without scoring, which
+// washes out its unknown starting flux, then ray_active_length scoring the
+// change in its angular flux across every cell it crosses. The angular fluxes
+// are carried in scalar flux units, so a ray in equilibrium with the source q
+// of a cell with total xs xs has flux q/xs.
+
+// State shared by the threads of the pool during an iteration
+typedef struct Sweep_{
+  Parameters *parameters;
+  Geometry *geometry;
+  Tally *tally;
+  double *q; // isotropic source in each cell
+  double *xs; // total macro xs of each cell
+  double **delta; // change in angular flux summed in each cell, per thread
+  double **length; // track length in each cell, per thread
+  unsigned long n_done; // number of rays traced in earlier iterations
+  unsigned long n_cells;
+  int n_threads;
+} Sweep;
+
+// Grid box of coordinate x along an axis of the tally mesh, clamped so points
+// on the domain boundary fall in the boxes next to it
+static int axis_bin(double x, double dx, int n)
+{
+  int i = x/dx;
+
+  if(i < 0) i = 0;
+  if(i >= n) i = n - 1;
+
+  return i;
+}
+
+// Distance to the nearest interior plane of the tally mesh along the particle
+// direction, with the axis it lies on; the domain boundary is left to
+// distance_to_boundary()
+static double distance_to_bin(Tally *t, int *ix, Particle *p, int *axis)
+{
+  int i;
+  int n = TALLY_N(t);
+  double d = D_INF, dist;
+  double x[3] = {p->x, p->y, p->z};
+  double u[3] = {p->u, p->v, p->w};
+  double dx[3] = {TALLY_DX(t), TALLY_DY(t), TALLY_DZ(t)};
+
+  for(i=0; i<3; i++){
+    if(u[i] > 0 && ix[i] + 1 < n){
+      dist = ((ix[i] + 1)*dx[i] - x[i])/u[i];
+    }
+    else if(u[i] < 0 && ix[i] > 0){
+      dist = (ix[i]*dx[i] - x[i])/u[i];
+    }
+    else continue;
+    if(dist < d){
+      d = dist;
+      *axis = i;
+    }
+  }
+
+  return d;
+}
+
+// Crosses the domain boundary. A ray that leaks out through a vacuum boundary
+// is reflected back in with no angular flux, so the rays keep covering the
+// domain uniformly.
+static void cross_ray_boundary(Parameters *parameters, Geometry *geometry, Tally *tally, Particle *p, double *psi)
+{
+  Geometry reflect;
+
+  cross_surface(parameters, geometry, tally, p);
+  if(!p->alive){
+    reflect = *geometry;
+    reflect.bc = REFLECT;
+    p->alive = TRUE;
+    cross_surface(parameters, &reflect, tally, p);
+    *psi = 0;
+  }
+
+  return;
+}
+
+// Traces one ray through its dead and active lengths
+static void trace_ray(Sweep *s, double *delta, double *length, Particle *p)
+{
+  int active = FALSE;
+  int axis = 0;
+  int ix[3] = {0, 0, 0};
+  int n = TALLY_N(s->tally);
+  unsigned long i;
+  double remaining = s->parameters->ray_dead_length;
+  double psi; // angular flux of the ray
+  double d, d_b, dpsi;
+  Geometry *geometry = s->geometry;
+  Tally *t = s->tally;
+
+  // Find the cell of the starting point as score_tally() does
+  if(GEOMETRY_TYPE(geometry) == TET_MESH){
+    i = p->cell;
+  }
+  else{
+    ix[0] = axis_bin(p->x, TALLY_DX(t), n);
+    ix[1] = axis_bin(p->y, TALLY_DY(t), n);
+    ix[2] = axis_bin(p->z, TALLY_DZ(t), n);
+    i = ix[0] + (unsigned long)n*ix[1] + (unsigned long)n*n*ix[2];
+  }
+  psi = s->q[i]/s->xs[i];
+
+  while(TRUE){
+
+    // Distance to the next cell, which on a box is either a plane of the tally
+    // mesh or the domain boundary
+    d = d_b = distance_to_boundary(geometry, p);
+    if(GEOMETRY_TYPE(geometry) != TET_MESH){
+      d = distance_to_bin(t, ix, p, &axis);
+      if(d_b <= d) d = d_b;
+    }
+    if(d > remaining) d = remaining;
+
+    // Attenuate the ray toward the flat source of the cell
+    dpsi = -(psi - s->q[i]/s->xs[i])*expm1(-s->xs[i]*d);
+    psi -= dpsi;
+    if(active == TRUE){
+      delta[i] += dpsi;
+      length[i] += d;
+    }
+
+    p->x += d*p->u;
+    p->y += d*p->v;
+    p->z += d*p->w;
+    remaining -= d;
+
+    // End of the dead or active length
+    if(remaining <= 0){
+      if(active == TRUE) break;
+      active = TRUE;
+      remaining = s->parameters->ray_active_length;
+      continue;
+    }
+
+    // Move to the next cell
+    if(GEOMETRY_TYPE(geometry) == TET_MESH){
+      if(geometry->mesh->neighbor[4*p->cell + p->surface_crossed] < 0){
+        cross_ray_boundary(s->parameters, geometry, t, p, &psi);
+      }
+      else{
+        cross_surface(s->parameters, geometry, t, p);
+      }
+      i = p->cell;
+    }
+    else{
+      if(d == d_b){
+        cross_ray_boundary(s->parameters, geometry, t, p, &psi);
+        axis = p->surface_crossed/2;
+        ix[axis] = axis_bin(axis == 0 ? p->x : axis == 1 ? p->y : p->z,
+           axis == 0 ? TALLY_DX(t) : axis == 1 ? TALLY_DY(t) : TALLY_DZ(t), n);
+      }
+      else{
+        ix[axis] += (axis == 0 ? p->u : axis == 1 ? p->v : p->w) > 0 ? 1 : -1;
+      }
+      i = ix[0] + (unsigned long)n*ix[1] + (unsigned long)n*n*ix[2];
+    }
+  }
+
+  return;
+}
+
+// Traces a contiguous block of the rays of the iteration on each thread. Each
+// ray starts from its own place in the random number sequence, so the rays
+// are the same for any number of threads.
+static void ray_task(void *arg, int id)
+{
+  Sweep *s = arg;
+  unsigned long i_r; // index over rays
+  unsigned long n = s->parameters->n_particles;
+  unsigned long start = n*id/s->n_threads;
+  unsigned long end = n*(id+1)/s->n_threads;
+  Particle p;
+
+  set_stream(STREAM_TRACK);
+
+  for(i_r=start; i_r<end; i_r++){
+    rn_skip(s->n_done + i_r);
+    sample_source_particle(s->geometry, &p);
+    trace_ray(s, s->delta[id], s->length[id], &p);
+  }
+
+  set_stream(STREAM_OTHER);
+
+  return;
+}
+
+// Sums a slice of the cells of each thread's scores into thread 0's, in
+// thread order
+static void reduce_task(void *arg, int id)
+{
+  Sweep *s = arg;
+  unsigned long i;
+  unsigned long start = s->n_cells*id/s->n_threads;
+  unsigned long end = s->n_cells*(id+1)/s->n_threads;
+  int i_t;
+
+  for(i_t=1; i_t<s->n_threads; i_t++){
+    for(i=start; i<end; i++){
+      s->delta[0][i] += s->delta[i_t][i];
+      s->length[0][i] += s->length[i_t][i];
+      s->delta[i_t][i] = 0;
+      s->length[i_t][i] = 0;
+    }
+  }
+
+  return;
+}
+
+// Whether the center of a cell lies in the region of interest
+static int in_region(Geometry *geometry, Tally *t, unsigned long i)
+{
+  int k;
+  int n = TALLY_N(t);
+  double c[3] = {0, 0, 0};
+  double *r = geometry->region;
+  Mesh *m = geometry->mesh;
+
+  if(GEOMETRY_TYPE(geometry) == TET_MESH){
+    for(k=0; k<4; k++){
+      c[0] += m->nodes[3*m->tets[4*i+k]]/4;
+      c[1] += m->nodes[3*m->tets[4*i+k]+1]/4;
+      c[2] += m->nodes[3*m->tets[4*i+k]+2]/4;
+    }
+  }
+  else{
+    c[0] = (i%n + 0.5)*TALLY_DX(t);
+    c[1] = (i/n%n + 0.5)*TALLY_DY(t);
+    c[2] = (i/n/n + 0.5)*TALLY_DZ(t);
+  }
+
+  return c[0] >= r[0] && c[0] <= r[1] && c[1] >= r[2] && c[1] <= r[3] &&
+     c[2] >= r[4] && c[2] <= r[5];
+}
+
+// Runs power iterations of the flat source flux and keff, one iteration per
+// batch. The flux is normalized to one fission source neutron, so it is per
+// source particle like the Monte Carlo tally. Returns FALSE if the run stopped
+// for a shutdown.
+int run_random_ray(Parameters *parameters, Pool *pool, Geometry *geometry, Material *material, Tally *tally, double *keff)
+{
+  int i_b; // index over iterations
+  int i_a = -1; // index over active iterations
+  int i_t;
+  unsigned long i;
+  unsigned long n_cells = tally->sz;
+  double k = 1; // keff of the iteration
+  double keff_mean, keff_std;
+  double F; // fission production of the new flux
+  double H; // shannon entropy of the fission source
+  double p_i; // fraction of the fission source in the cell
+  double *phi = malloc(n_cells*sizeof(double));
+  double *nu_f = malloc(n_cells*sizeof(double)); // fission production xs of each cell
+  double *xs_s = malloc(n_cells*sizeof(double));
+  double *volume = malloc(n_cells*sizeof(double));
+  Material *m;
+  Sweep s;
+
+  s.parameters = parameters;
+  s.geometry = geometry;
+  s.tally = tally;
+  s.n_cells = n_cells;
+  s.n_threads = pool->n_threads;
+  s.n_done = 0;
+  s.q = malloc(n_cells*sizeof(double));
+  s.xs = malloc(n_cells*sizeof(double));
+  s.delta = malloc(s.n_threads*sizeof(double*));
+  s.length = malloc(s.n_threads*sizeof(double*));
+  for(i_t=0; i_t<s.n_threads; i_t++){
+    s.delta[i_t] = calloc(n_cells, sizeof(double));
+    s.length[i_t] = calloc(n_cells, sizeof(double));
+  }
+
+  // Cross sections and volume of each cell, with a flat initial flux that
+  // produces one fission neutron, as for keff of 1
+  F = 0;
+  for(i=0; i<n_cells; i++){
+    m = material;
+    if(GEOMETRY_TYPE(geometry) == TET_MESH){
+      m = &(material[geometry->mesh->material[i]]);
+      volume[i] = tally->volume[i];
+    }
+    else{
+      volume[i] = TALLY_DX(tally)*TALLY_DY(tally)*TALLY_DZ(tally);
+    }
+    if(m->xs_t <= 0){
+      print_error("Random ray needs a positive total cross section in every material");
+    }
+    s.xs[i] = m->xs_t;
+    xs_s[i] = m->xs_s;
+    nu_f[i] = NU(parameters)*m->xs_f;
+    F += nu_f[i]*volume[i];
+  }
+  if(F <= 0){
+    print_error("Random ray needs a fissionable material");
+  }
+  for(i=0; i<n_cells; i++){
+    phi[i] = 1/F;
+  }
+
+  for(i_b=0; i_b<parameters->n_batches; i_b++){
+
+    // Stop at the iteration boundary once a shutdown is requested
+    if(shutdown_requested == TRUE){
+      printf("Shutdown requested: stopped at iteration %d\n", i_b+1);
+      break;
+    }
+
+    if(i_b >= parameters->n_batches - parameters->n_active){
+      i_a++;
+    }
+
+    // Flat isotropic source of scattering and fission
+    for(i=0; i<n_cells; i++){
+      s.q[i] = (xs_s[i] + nu_f[i]/k)*phi[i];
+    }
+
+    // Trace the rays and gather the scores of every thread
+    set_phase(PHASE_TRANSPORT);
+    pool_run(pool, ray_task, &s);
+    set_phase(PHASE_SYNC);
+    pool_run(pool, reduce_task, &s);
+    s.n_done += parameters->n_particles;
+    pool->n_histories += parameters->n_particles;
+    pool->n_generations++;
+
+    // New scalar flux: the flat source solution plus the mean change in the
+    // angular flux of the rays across the cell. A cell no ray reached keeps
+    // the flat source solution.
+    F = 0;
+    for(i=0; i<n_cells; i++){
+      phi[i] = s.q[i]/s.xs[i];
+      if(s.length[0][i] > 0){
+        phi[i] += s.delta[0][i]/(s.xs[i]*s.length[0][i]);
+      }
+      F += nu_f[i]*phi[i]*volume[i];
+      s.delta[0][i] = 0;
+      s.length[0][i] = 0;
+    }
+
+    // The source held one fission neutron, so the new flux produces keff of
+    // them and stays normalized to one source neutron for the next iteration
+    k = F;
+    set_phase(PHASE_ENTROPY);
+    H = 0;
+    for(i=0; i<n_cells; i++){
+      p_i = nu_f[i]*phi[i]*volume[i]/k;
+      if(p_i > 0){
+        H -= p_i*log(p_i)/log(2.0);
+      }
+    }
+    if(parameters->write_entropy == TRUE){
+      write_entropy(H, parameters->entropy_file);
+    }
+
+    // Tallies for this realization
+    if(i_a >= 0){
+      keff[i_a] = k;
+      tally->region_batch[i_a] = 0;
+      for(i=0; i<n_cells; i++){
+        tally->flux[i] = phi[i];
+        if(in_region(geometry, tally, i)){
+          tally->region_batch[i_a] += phi[i]*volume[i];
+        }
+      }
+      if(parameters->write_tally == TRUE){
+        write_tally(tally, parameters->tally_file);
+      }
+    }
+
+    // Status text
+    calculate_keff(keff, &keff_mean, &keff_std, i_a+1);
+    if(i_a < 0){
+      printf("%-15d %-15f %-15f\n", i_b+1, H, k);
+    }
+    else{
+      printf("%-15d %-15f %-15f %f +/- %-15f\n", i_b+1, H, k, keff_mean, keff_std);
+    }
+  }
+
+  if(i_b == parameters->n_batches && parameters->write_keff == TRUE){
+    write_keff(keff, parameters->n_active, parameters->keff_file);
+  }
+
+  for(i_t=0; i_t<s.n_threads; i_t++){
+    free(s.delta[i_t]);
+    free(s.length[i_t]);
+  }
+  free(s.delta);
+  free(s.length);
+  free(s.q);
+  free(s.xs);
+  free(phi);
+  free(nu_f);
+  free(xs_s);
+  free(volume);
+
+  return i_b == parameters->n_batches;
+}
@@ -0,0 +1,239 @@
+#include "simple_mc.h"
+#include<signal.h>
+
+// Fraction of the shutdown deadline the generation in flight may use before
+// it is abandoned, leaving the rest for writing the restart file
+#define DEADLINE_FRACTION 0.8
+
+// Identifies a restart file and its layout version
+static const char MAGIC[8] = "SMCRST4";
+
+// Set by the signal handler once SIGTERM or SIGINT arrives, with the time it
+// arrived
+volatile sig_atomic_t shutdown_requested = FALSE;
+static double t_shutdown;
+
+// Requests a shutdown on the first signal and restores the default handlers,
+// so a second signal kills a run that is stuck
+static void request_shutdown(int signum)
+{
+  struct sigaction sa;
+
+  if(shutdown_requested == FALSE){
+    t_shutdown = timer();
+    shutdown_requested = TRUE;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+  }
+
+  return;
+}
+
+// Installs the handler that turns SIGTERM and SIGINT into a request to write a
+// restart file and stop at the next generation boundary; a second signal
+// stops the run at once
+void init_signals(void)
+{
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_shutdown;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  return;
+}
+
+// Whether a thread that has transported n_done particles of its block since
+// t_start, with n_left still to go, should give up the generation because it
+// wouldn't finish before the deadline
+int past_deadline(Parameters *parameters, unsigned long n_done, unsigned long n_left, double t_start)
+{
+  double t = timer();
+  double t_end = t_shutdown + DEADLINE_FRACTION*parameters->shutdown_deadline;
+
+  if(n_done == 0) return t > t_end;
+
+  return t + (t - t_start)/n_done*n_left > t_end;
+}
+
+static void write_block(void *p, size_t size, size_t n, FILE *fp)
+{
+  if(fwrite(p, size, n, fp) != n){
+    print_error("Error writing restart file.");
+  }
+
+  return;
+}
+
+static void read_block(void *p, size_t size, size_t n, FILE *fp)
+{
+  if(fread(p, size, n, fp) != n){
+    print_error("Error reading restart file.");
+  }
+
+  return;
+}
+
+// Writes the state of the run at a generation boundary. The file is laid out
+// as
+//   magic               char[8]
+//   seed                unsigned long long, initial RNG seed
+//   n_particles         unsigned long
+//   n_batches, n_generations, n_active, tally, geometry, symmetry,
+//   cached_source       int, n_batches after any cut for a cached source
+//   tally sz            unsigned long, tally bins
+//   r                   Restart, counters and STREAM_OTHER seed
+//   n_source            unsigned long, sites in the source bank
+//   keff                double[n_active]
+//   region_batch        double[n_active], if tallying
+//   region_flux         double, if tallying
+//   point_batch         double[n_active], if tallying
+//   point_flux          double, if tallying
+//   flux                double[tally sz], if tallying
+//   source bank         Particle[n_source]
+// It is written to a temporary file that is renamed over the old one, so a
+// restart file is never left half written.
+void write_restart(Parameters *parameters, Restart *r, Bank *source_bank, Tally *tally, double *keff)
+{
+  char *tmp;
+  FILE *fp;
+
+  set_phase(PHASE_IO);
+
+  tmp = malloc(strlen(parameters->restart_file) + 5);
+  sprintf(tmp, "%s.tmp", parameters->restart_file);
+
+  fp = fopen(tmp, "wb");
+  if(fp == NULL){
+    print_error("Couldn't open restart file.");
+  }
+
+  write_block((void *)MAGIC, sizeof(char), 8, fp);
+  write_block(&(parameters->seed), sizeof(unsigned long long), 1, fp);
+  write_block(&(parameters->n_particles), sizeof(unsigned long), 1, fp);
+  write_block(&(parameters->n_batches), sizeof(int), 1, fp);
+  write_block(&(parameters->n_generations), sizeof(int), 1, fp);
+  write_block(&(parameters->n_active), sizeof(int), 1, fp);
+  write_block(&(parameters->tally), sizeof(int), 1, fp);
+  write_block(&(parameters->geometry), sizeof(int), 1, fp);
+  write_block(&(parameters->symmetry), sizeof(int), 1, fp);
+  write_block(&(parameters->cached_source), sizeof(int), 1, fp);
+  write_block(&(tally->sz), sizeof(unsigned long), 1, fp);
+  write_block(r, sizeof(Restart), 1, fp);
+  write_block(&(source_bank->n), sizeof(unsigned long), 1, fp);
+  write_block(keff, sizeof(double), parameters->n_active, fp);
+  if(parameters->tally == TRUE){
+    write_block(tally->region_batch, sizeof(double), parameters->n_active, fp);
+    write_block(&(tally->region_flux), sizeof(double), 1, fp);
+    write_block(tally->point_batch, sizeof(double), parameters->n_active, fp);
+    write_block(&(tally->point_flux), sizeof(double), 1, fp);
+    write_block(tally->flux, sizeof(double), tally->sz, fp);
+  }
+  write_block(source_bank->p, sizeof(Particle), source_bank->n, fp);
+
+  if(fclose(fp) != 0 || rename(tmp, parameters->restart_file) != 0){
+    print_error("Error writing restart file.");
+  }
+
+  free(tmp);
+
+  return;
+}
+
+// Opens the restart file and reads the header up to the tally size, with n
+// the ints n_batches to cached_source
+static FILE *open_restart(Parameters *parameters, unsigned long long *seed, unsigned long *n_particles, int *n)
+{
+  char magic[8];
+  FILE *fp;
+
+  fp = fopen(parameters->restart_file, "rb");
+  if(fp == NULL){
+    print_error("Couldn't open restart file.");
+  }
+
+  read_block(magic, sizeof(char), 8, fp);
+  if(memcmp(magic, MAGIC, 8) != 0){
+    print_error("Not a restart file.");
+  }
+  read_block(seed, sizeof(unsigned long long), 1, fp);
+  read_block(n_particles, sizeof(unsigned long), 1, fp);
+  read_block(n, sizeof(int), 7, fp);
+
+  return fp;
+}
+
+// Takes the number of batches of the run being resumed. A run that started
+// from a cached source ran n_active + cached_inactive batches; the cache isn't
+// looked up again on resume, so the cut is applied here, after checking it is
+// the one this input would have made.
+void resume_batches(Parameters *parameters)
+{
+  unsigned long long seed;
+  unsigned long n_particles;
+  int n[7];
+  int n_batches = parameters->n_batches;
+  FILE *fp = open_restart(parameters, &seed, &n_particles, n);
+
+  fclose(fp);
+
+  if(n[6] == TRUE && n_batches - parameters->n_active > parameters->cached_inactive){
+    n_batches = parameters->n_active + parameters->cached_inactive;
+  }
+  if(n[0] != n_batches){
+    print_error("Restart file was written by a run with different parameters.");
+  }
+  if(n_batches != parameters->n_batches){
+    parameters->n_batches = n_batches;
+    printf("Reduced number of batches to %d as in the run started from a cached source\n", n_batches);
+  }
+  parameters->cached_source = n[6];
+
+  return;
+}
+
+// Reads the state written by write_restart, checking that it came from a run
+// of the same problem
+void read_restart(Parameters *parameters, Restart *r, Bank *source_bank, Tally *tally, double *keff)
+{
+  unsigned long long seed;
+  unsigned long n_particles;
+  unsigned long sz;
+  int n[7];
+  FILE *fp = open_restart(parameters, &seed, &n_particles, n);
+
+  read_block(&sz, sizeof(unsigned long), 1, fp);
+  if(seed != parameters->seed || n_particles != parameters->n_particles ||
+     n[0] != parameters->n_batches || n[1] != parameters->n_generations ||
+     n[2] != parameters->n_active || n[3] != parameters->tally ||
+     n[4] != parameters->geometry || n[5] != parameters->symmetry ||
+     n[6] != parameters->cached_source || sz != tally->sz){
+    print_error("Restart file was written by a run with different parameters.");
+  }
+
+  read_block(r, sizeof(Restart), 1, fp);
+  read_block(&(source_bank->n), sizeof(unsigned long), 1, fp);
+  read_block(keff, sizeof(double), parameters->n_active, fp);
+  if(parameters->tally == TRUE){
+    read_block(tally->region_batch, sizeof(double), parameters->n_active, fp);
+    read_block(&(tally->region_flux), sizeof(double), 1, fp);
+    read_block(tally->point_batch, sizeof(double), parameters->n_active, fp);
+    read_block(&(tally->point_flux), sizeof(double), 1, fp);
+    read_block(tally->flux, sizeof(double), tally->sz, fp);
+  }
+  while(source_bank->sz < source_bank->n){
+    source_bank->resize(source_bank);
+  }
+  read_block(source_bank->p, sizeof(Particle), source_bank->n, fp);
+
+  fclose(fp);
+
+  return;
+}
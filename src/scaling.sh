@@ -0,0 +1,98 @@
+#!/bin/bash
+# Strong and weak scaling study. Runs the solver over a sweep of thread and
+# process counts, with a fixed total number of particles (strong scaling) and
+# a fixed number of particles per worker (weak scaling), and reports the
+# tracking rate, parallel efficiency and time in each phase of the run. A
+# phase whose share of the time grows with the worker count, such as sync for
+# synchronize_bank(), is a serial fraction. Arguments are passed to every run,
+# e.g.
+#   ./scaling.sh -batches 10 -active 5
+# or through 'make scaling ARGS="..."'. The sweep is set with
+#   THREADS     thread counts (default "1 2 4 8")
+#   PROCS       process counts (default "1 2")
+#   PARTICLES   total particles per generation for strong scaling (1000000)
+#   PER_WORKER  particles per generation of each worker for weak scaling (100000)
+#   RUNS        repeats of each point, to estimate the noise (3)
+#   CSV         file to write the table to (scaling.csv)
+# The processes of a point are independent runs with their own seeds, started
+# together and sharing the particles. Their rate is the histories they
+# transported together over the time of the slowest. When the workers of a
+# point fit on the cpus the script may use, each process is bound with taskset
+# to its own set of cpus and pins its threads within it; otherwise the threads
+# aren't pinned, so the processes don't pile onto the same cores.
+
+THREADS=${THREADS:-"1 2 4 8"}
+PROCS=${PROCS:-"1 2"}
+PARTICLES=${PARTICLES:-1000000}
+PER_WORKER=${PER_WORKER:-100000}
+RUNS=${RUNS:-3}
+CSV=${CSV:-scaling.csv}
+
+make -s transport || exit 1
+
+# Cpus the script may run on, one per element
+CPUS=($(awk '/^Cpus_allowed_list/ {n = split($2, r, ",");
+   for(k=1; k<=n; k++) {m = split(r[k], b, "-"); for(c=b[1]; c<=b[m]; c++) print c}}' /proc/self/status))
+
+echo "mode,processes,threads,workers,particles,rate,rate_std,efficiency,transport,sync,entropy,io,other" > "$CSV"
+printf "%-7s %5s %7s %7s %10s %11s %9s %6s %9s %6s %8s %6s\n" "MODE" "PROCS" "THREADS" \
+   "WORKERS" "PARTICLES" "RATE" "+/-" "EFF" "TRANSPORT" "SYNC" "ENTROPY" "I/O"
+
+for mode in strong weak; do
+  rate_1=""
+  for p in $PROCS; do
+    for t in $THREADS; do
+      w=$((p*t))
+      if [ $mode = strong ]; then
+        n=$((PARTICLES/p))
+      else
+        n=$((PER_WORKER*t))
+      fi
+
+      # One line per run: the combined rate of the processes and their mean
+      # time in each phase
+      for((r=0; r<RUNS; r++)); do
+        for((i=0; i<p; i++)); do
+          if [ $p -gt 1 ] && [ $w -le ${#CPUS[@]} ] && command -v taskset > /dev/null; then
+            set=$(IFS=,; echo "${CPUS[*]:$((i*t)):$t}")
+            bind="taskset -c $set"
+            pin=true
+          else
+            bind=""
+            pin=$([ $p -gt 1 ] && echo false || echo true)
+          fi
+          $bind ./transport -threads $t -particles $n -seed $((1 + r*p + i)) -pin_threads $pin \
+             "$@" > scaling.$i.out &
+        done
+        wait
+        cat scaling.[0-9]*.out | awk -v p=$p '
+           /^Simulation time:/ {t = $3; if(t > t_max) t_max = t}
+           /^Tracking rate:/ {n += $3*t}
+           /^Phase times/ {for(k=4; k<NF; k+=2) {v = $(k+1); sub(",", "", v); s[$k] += v}}
+           END {printf("%e %f %f %f %f %f\n", n/t_max, s["transport"]/p, s["sync"]/p,
+              s["entropy"]/p, s["I/O"]/p, s["other"]/p)}'
+        rm -f scaling.[0-9]*.out
+      done > scaling.runs
+
+      # Mean and standard deviation of the rate over the runs, mean phase times
+      read rate std tr sy en io ot < <(awk '{n++; r += $1; r2 += $1*$1;
+         for(k=2; k<=6; k++) s[k] += $k}
+         END {m = r/n; v = n > 1 ? (r2 - n*m*m)/(n - 1) : 0;
+            printf("%e %e %f %f %f %f %f\n", m, v > 0 ? sqrt(v) : 0,
+               s[2]/n, s[3]/n, s[4]/n, s[5]/n, s[6]/n)}' scaling.runs)
+      rm -f scaling.runs
+
+      # Efficiency against the first point of the sweep, scaled to one worker
+      if [ -z "$rate_1" ]; then
+        rate_1=$(awk "BEGIN {print $rate/$w}")
+      fi
+      eff=$(awk "BEGIN {printf \"%.3f\", $rate/($w*$rate_1)}")
+
+      echo "$mode,$p,$t,$w,$n,$rate,$std,$eff,$tr,$sy,$en,$io,$ot" >> "$CSV"
+      printf "%-7s %5d %7d %7d %10d %11.4e %9.2e %6s %9.3f %6.3f %8.3f %6.3f\n" $mode $p $t \
+         $w $n $rate $std $eff $tr $sy $en $io
+    done
+  done
+done
+
+echo "Wrote $CSV"
@@ -0,0 +1,318 @@
+#include "simple_mc.h"
+#include<stddef.h>
+#include<immintrin.h>
+
+// Each kernel is built in a scalar, AVX2 and AVX-512 variant in this one
+// translation unit using per-function target attributes, so a single binary
+// runs on any x86-64 node. init_kernels picks the variants once at startup.
+// The vector variants do the same floating point operations per lane as the
+// scalar ones (no fused multiply-adds), so results don't depend on the
+// variant.
+
+#define AVX2 __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f")))
+
+static const char *variant_names[] = {"auto", "scalar", "avx2", "avx512"};
+
+// Adds a site to grid box i of counts that other threads may be adding to at
+// the same time when shared is set
+#define COUNT_SITE(count, i, shared) \
+  do{ \
+    if(shared) __atomic_fetch_add(&(count)[i], 1, __ATOMIC_RELAXED); \
+    else (count)[i]++; \
+  } while(0)
+
+// Distance to the nearest face of the box along the particle's direction
+static double box_distance_scalar(Geometry *geometry, Particle *p)
+{
+  int i;
+  double dist;
+  double d = D_INF;
+
+  int    surfaces[6] = {X0, X1, Y0, Y1, Z0, Z1};
+  double p_angles[6] = {p->u, p->u, p->v, p->v, p->w, p->w};
+  double p_coords[6] = {p->x, p->x, p->y, p->y, p->z, p->z};
+  double s_coords[6] = {0, LX(geometry), 0, LY(geometry), 0, LZ(geometry)};
+
+  for(i=0; i<6; i++){
+    if(p_angles[i] == 0){
+      dist = D_INF;
+    }
+    else{
+      dist = (s_coords[i] - p_coords[i])/p_angles[i];
+      if(dist <= 0){
+        dist = D_INF;
+      }
+    }
+    if(dist < d){
+      d = dist;
+      p->surface_crossed = surfaces[i];
+    }
+  }
+
+  return d;
+}
+
+// The six distances in two vectors: x and y faces, then the z faces twice
+AVX2 static double box_distance_avx2(Geometry *geometry, Particle *p)
+{
+  int i;
+  double d = D_INF;
+  double dist[8];
+  __m256d s, c, a, q, bad;
+  __m256d zero = _mm256_setzero_pd();
+  __m256d inf = _mm256_set1_pd(D_INF);
+
+  s = _mm256_setr_pd(0, LX(geometry), 0, LY(geometry));
+  c = _mm256_setr_pd(p->x, p->x, p->y, p->y);
+  a = _mm256_setr_pd(p->u, p->u, p->v, p->v);
+  q = _mm256_div_pd(_mm256_sub_pd(s, c), a);
+  bad = _mm256_or_pd(_mm256_cmp_pd(a, zero, _CMP_EQ_OQ), _mm256_cmp_pd(q, zero, _CMP_NGT_UQ));
+  _mm256_storeu_pd(dist, _mm256_blendv_pd(q, inf, bad));
+
+  s = _mm256_setr_pd(0, LZ(geometry), 0, LZ(geometry));
+  c = _mm256_set1_pd(p->z);
+  a = _mm256_set1_pd(p->w);
+  q = _mm256_div_pd(_mm256_sub_pd(s, c), a);
+  bad = _mm256_or_pd(_mm256_cmp_pd(a, zero, _CMP_EQ_OQ), _mm256_cmp_pd(q, zero, _CMP_NGT_UQ));
+  _mm256_storeu_pd(dist + 4, _mm256_blendv_pd(q, inf, bad));
+
+  // First surface at the minimum distance, as in the scalar loop
+  for(i=0; i<6; i++){
+    if(dist[i] < d){
+      d = dist[i];
+      p->surface_crossed = i;
+    }
+  }
+
+  return d;
+}
+
+// The six distances in the low lanes of one vector
+AVX512 static double box_distance_avx512(Geometry *geometry, Particle *p)
+{
+  double d;
+  __m512d s, c, a, q;
+  __mmask8 ok;
+  __m512d zero = _mm512_setzero_pd();
+
+  s = _mm512_setr_pd(0, LX(geometry), 0, LY(geometry), 0, LZ(geometry), 0, 0);
+  c = _mm512_setr_pd(p->x, p->x, p->y, p->y, p->z, p->z, 0, 0);
+  a = _mm512_setr_pd(p->u, p->u, p->v, p->v, p->w, p->w, 0, 0);
+
+  ok = _mm512_cmp_pd_mask(a, zero, _CMP_NEQ_UQ) & 0x3F;
+  q = _mm512_mask_div_pd(zero, ok, _mm512_sub_pd(s, c), a);
+  ok &= _mm512_cmp_pd_mask(q, zero, _CMP_GT_OQ);
+  q = _mm512_mask_blend_pd(ok, _mm512_set1_pd(D_INF), q);
+  d = _mm512_reduce_min_pd(q);
+
+  // First surface at the minimum distance, as in the scalar loop
+  if(d < D_INF){
+    p->surface_crossed = __builtin_ctz(_mm512_cmp_pd_mask(q, _mm512_set1_pd(d), _CMP_EQ_OQ));
+  }
+
+  return d;
+}
+
+// Macroscopic cross sections of a material summed over its nuclides
+static void calculate_xs_scalar(Material *material)
+{
+  int i;
+
+  // Reset macroscopic cross sections to 0
+  material->xs_t = 0.0;
+  material->xs_f = 0.0;
+  material->xs_a = 0.0;
+  material->xs_s = 0.0;
+
+  for(i=0; i<material->n_nuclides; i++){
+
+    Nuclide nuc = material->nuclides[i];
+
+    // Add contribution from this nuclide to total macro xs
+    material->xs_t += nuc.atom_density * nuc.xs_t;
+
+    // Add contribution from this nuclide to fission macro xs
+    material->xs_f += nuc.atom_density * nuc.xs_f;
+
+    // Add contribution from this nuclide to absorption macro xs
+    material->xs_a += nuc.atom_density * nuc.xs_a;
+
+    // Add contribution from this nuclide to scattering macro xs
+    material->xs_s += nuc.atom_density * nuc.xs_s;
+  }
+
+  return;
+}
+
+// The fission, absorption, scattering and total xs are laid out in the same
+// order in Nuclide and Material, so one vector holds all four. There are only
+// four to sum, so the AVX-512 variant uses this one too.
+#define XS_ADJACENT(T) (offsetof(T, xs_a) == offsetof(T, xs_f) + sizeof(double) && \
+   offsetof(T, xs_s) == offsetof(T, xs_f) + 2*sizeof(double) && \
+   offsetof(T, xs_t) == offsetof(T, xs_f) + 3*sizeof(double))
+_Static_assert(XS_ADJACENT(Nuclide), "Nuclide xs_f, xs_a, xs_s and xs_t must be adjacent and in that order");
+_Static_assert(XS_ADJACENT(Material), "Material xs_f, xs_a, xs_s and xs_t must be adjacent and in that order");
+_Static_assert(offsetof(Nuclide, xs_t) - offsetof(Nuclide, xs_f) == offsetof(Material, xs_t) - offsetof(Material, xs_f) &&
+   offsetof(Nuclide, xs_s) - offsetof(Nuclide, xs_f) == offsetof(Material, xs_s) - offsetof(Material, xs_f) &&
+   offsetof(Nuclide, xs_a) - offsetof(Nuclide, xs_f) == offsetof(Material, xs_a) - offsetof(Material, xs_f),
+   "Nuclide and Material must order their xs the same way");
+
+AVX2 static void calculate_xs_avx2(Material *material)
+{
+  int i;
+  __m256d xs = _mm256_setzero_pd();
+  Nuclide *nuc;
+
+  for(i=0; i<material->n_nuclides; i++){
+    nuc = &(material->nuclides[i]);
+    xs = _mm256_add_pd(xs, _mm256_mul_pd(_mm256_set1_pd(nuc->atom_density),
+       _mm256_loadu_pd(&(nuc->xs_f))));
+  }
+  _mm256_storeu_pd(&(material->xs_f), xs);
+
+  return;
+}
+
+// Adds the sites of a bank to the counts of an n*n*n grid with spacing d,
+// indexed as ix*n*n + iy*n + iz; the counts are updated atomically when shared
+static void count_sites_scalar(Particle *p, unsigned long n_p, double *d, unsigned long n, unsigned long *count, int shared)
+{
+  unsigned long i;
+  unsigned long ix, iy, iz;
+
+  for(i=0; i<n_p; i++){
+    ix = p[i].x/d[0];
+    iy = p[i].y/d[1];
+    iz = p[i].z/d[2];
+    COUNT_SITE(count, ix*n*n + iy*n + iz, shared);
+  }
+
+  return;
+}
+
+// The gathers step 8 doubles from one site to the next and read y and z one
+// and two doubles past x
+_Static_assert(sizeof(Particle) == 8*sizeof(double), "count_sites gathers assume 64-byte particles");
+_Static_assert(offsetof(Particle, x) == 0 && offsetof(Particle, y) == sizeof(double) &&
+   offsetof(Particle, z) == 2*sizeof(double), "count_sites gathers assume x, y and z lead the particle");
+
+// Gathers the coordinates of four sites at a time and finds their grid
+// indices; the counts themselves are incremented one site at a time since
+// sites often share a box
+AVX2 static void count_sites_avx2(Particle *p, unsigned long n_p, double *d, unsigned long n, unsigned long *count, int shared)
+{
+  unsigned long i;
+  int j;
+  int ix[4], iy[4], iz[4];
+  double *base;
+  __m256i stride = _mm256_setr_epi64x(0, 8, 16, 24);
+  __m256d dx = _mm256_set1_pd(d[0]);
+  __m256d dy = _mm256_set1_pd(d[1]);
+  __m256d dz = _mm256_set1_pd(d[2]);
+
+  for(i=0; i+4<=n_p; i+=4){
+    base = &(p[i].x);
+    _mm_storeu_si128((__m128i *)ix, _mm256_cvttpd_epi32(_mm256_div_pd(
+       _mm256_i64gather_pd(base, stride, 8), dx)));
+    _mm_storeu_si128((__m128i *)iy, _mm256_cvttpd_epi32(_mm256_div_pd(
+       _mm256_i64gather_pd(base + 1, stride, 8), dy)));
+    _mm_storeu_si128((__m128i *)iz, _mm256_cvttpd_epi32(_mm256_div_pd(
+       _mm256_i64gather_pd(base + 2, stride, 8), dz)));
+    for(j=0; j<4; j++){
+      COUNT_SITE(count, ix[j]*n*n + iy[j]*n + iz[j], shared);
+    }
+  }
+  count_sites_scalar(p + i, n_p - i, d, n, count, shared);
+
+  return;
+}
+
+AVX512 static void count_sites_avx512(Particle *p, unsigned long n_p, double *d, unsigned long n, unsigned long *count, int shared)
+{
+  unsigned long i;
+  int j;
+  int ix[8], iy[8], iz[8];
+  double *base;
+  __m512i stride = _mm512_setr_epi64(0, 8, 16, 24, 32, 40, 48, 56);
+  __m512d dx = _mm512_set1_pd(d[0]);
+  __m512d dy = _mm512_set1_pd(d[1]);
+  __m512d dz = _mm512_set1_pd(d[2]);
+
+  for(i=0; i+8<=n_p; i+=8){
+    base = &(p[i].x);
+    _mm256_storeu_si256((__m256i *)ix, _mm512_cvttpd_epi32(_mm512_div_pd(
+       _mm512_i64gather_pd(stride, base, 8), dx)));
+    _mm256_storeu_si256((__m256i *)iy, _mm512_cvttpd_epi32(_mm512_div_pd(
+       _mm512_i64gather_pd(stride, base + 1, 8), dy)));
+    _mm256_storeu_si256((__m256i *)iz, _mm512_cvttpd_epi32(_mm512_div_pd(
+       _mm512_i64gather_pd(stride, base + 2, 8), dz)));
+    for(j=0; j<8; j++){
+      COUNT_SITE(count, ix[j]*n*n + iy[j]*n + iz[j], shared);
+    }
+  }
+  count_sites_scalar(p + i, n_p - i, d, n, count, shared);
+
+  return;
+}
+
+// Kernel table, scalar until init_kernels runs
+Kernels kernels = {
+  box_distance_scalar, SIMD_SCALAR,
+  calculate_xs_scalar, SIMD_SCALAR,
+  count_sites_scalar, SIMD_SCALAR
+};
+
+// Selects the widest variant the cpu supports, or the one forced by the simd
+// parameter
+void init_kernels(Parameters *parameters)
+{
+  int simd = parameters->simd;
+
+  __builtin_cpu_init();
+
+  if(simd == SIMD_AUTO){
+    if(__builtin_cpu_supports("avx512f"))
+      simd = SIMD_AVX512;
+    else if(__builtin_cpu_supports("avx2"))
+      simd = SIMD_AVX2;
+    else
+      simd = SIMD_SCALAR;
+  }
+  else if(simd == SIMD_AVX512 && !__builtin_cpu_supports("avx512f")){
+    print_error("SIMD variant 'avx512' is not supported by this cpu");
+  }
+  else if(simd == SIMD_AVX2 && !__builtin_cpu_supports("avx2")){
+    print_error("SIMD variant 'avx2' is not supported by this cpu");
+  }
+
+  if(simd == SIMD_AVX512){
+    kernels.box_distance = box_distance_avx512;
+    kernels.box_distance_variant = SIMD_AVX512;
+    kernels.calculate_xs = calculate_xs_avx2;
+    kernels.calculate_xs_variant = SIMD_AVX2;
+    kernels.count_sites = count_sites_avx512;
+    kernels.count_sites_variant = SIMD_AVX512;
+  }
+  else if(simd == SIMD_AVX2){
+    kernels.box_distance = box_distance_avx2;
+    kernels.box_distance_variant = SIMD_AVX2;
+    kernels.calculate_xs = calculate_xs_avx2;
+    kernels.calculate_xs_variant = SIMD_AVX2;
+    kernels.count_sites = count_sites_avx2;
+    kernels.count_sites_variant = SIMD_AVX2;
+  }
+
+  return;
+}
+
+// Prints the variant each kernel runs
+void print_kernels(void)
+{
+  printf("SIMD kernels: distance_to_boundary %s, calculate_xs %s, count_sites %s\n",
+     variant_names[kernels.box_distance_variant],
+     variant_names[kernels.calculate_xs_variant],
+     variant_names[kernels.count_sites_variant]);
+
+  return;
+}
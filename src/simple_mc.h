@@ -7,8 +7,13 @@
 #include<sys/time.h>
 #include<math.h>
 #include<float.h>
+#include<limits.h>
 #include<unistd.h>
 #include<string.h>
+#include<pthread.h>
+#include<signal.h>
+#include<sysexits.h>
+#include "source_plugin.h"
 
 #define TRUE 1
 #define FALSE 0
@@ -22,6 +27,42 @@
 #define REFLECT 1
 #define PERIODIC 2
 
+// Huge page backing of large arrays
+#define HUGE_NONE 0
+#define HUGE_THP 1
+#define HUGE_HUGETLBFS 2
+
+// SIMD kernel variants
+#define SIMD_AUTO 0
+#define SIMD_SCALAR 1
+#define SIMD_AVX2 2
+#define SIMD_AVX512 3
+
+// Geometry types
+#define BOX 0
+#define TET_MESH 1
+
+// Population control methods
+#define RESERVOIR 0
+#define COMB 1
+
+// Fission banking methods
+#define ANALOG 0
+#define IMPLICIT 1
+
+// Run modes
+#define EIGENVALUE 0
+#define FORWARD 1
+#define ADJOINT 2
+
+// Eigenvalue solvers
+#define MONTE_CARLO 0
+#define RANDOM_RAY 1
+
+// Domain symmetries
+#define NO_SYMMETRY 0
+#define OCTANT 1
+
 // Reaction types
 #define TOTAL 0
 #define ABSORPTION 1
@@ -35,11 +76,89 @@
 #define Y1 3
 #define Z0 4
 #define Z1 5
+#define ALL_SURFACES 6
+#define NO_SURFACE -1
 
 // RNG streams
-#define N_STREAMS 2
+#define N_STREAMS 3
 #define STREAM_TRACK 0
 #define STREAM_OTHER 1
+#define STREAM_SOURCE 2
+
+// Profiler phases
+#define PHASE_OTHER 0
+#define PHASE_TRANSPORT 1
+#define PHASE_SYNC 2
+#define PHASE_ENTROPY 3
+#define PHASE_IO 4
+#define N_PHASES 5
+
+// Cost map counters of each tally bin
+#define COST_COLLISIONS 0
+#define COST_CROSSINGS 1
+#define COST_CYCLES 2
+#define N_COSTS 3
+
+// A problem-specialized build ('make specialized') includes a header written
+// by 'transport -specialize <file>' that fixes the parameters a campaign never
+// changes as compile-time constants. Each accessor below gives the constant if
+// there is one and the runtime value otherwise, so the compiler can fold the
+// constants into the hot loop and drop the dead branches.
+#ifdef PROBLEM
+#include PROBLEM
+#endif
+
+#ifdef PROBLEM_GEOMETRY
+#define GEOMETRY_TYPE(g) PROBLEM_GEOMETRY
+#else
+#define GEOMETRY_TYPE(g) ((g)->type)
+#endif
+
+#ifdef PROBLEM_BC
+#define BC(g) PROBLEM_BC
+#else
+#define BC(g) ((g)->bc)
+#endif
+
+#ifdef PROBLEM_LX
+#define LX(g) PROBLEM_LX
+#define LY(g) PROBLEM_LY
+#define LZ(g) PROBLEM_LZ
+#else
+#define LX(g) ((g)->Lx)
+#define LY(g) ((g)->Ly)
+#define LZ(g) ((g)->Lz)
+#endif
+
+#ifdef PROBLEM_XS_T
+#define XS_T(m) PROBLEM_XS_T
+#else
+#define XS_T(m) ((m)->xs_t)
+#endif
+
+#ifdef PROBLEM_N_BINS
+#define TALLY_N(t) PROBLEM_N_BINS
+#define TALLY_DX(t) (PROBLEM_LX/PROBLEM_N_BINS)
+#define TALLY_DY(t) (PROBLEM_LY/PROBLEM_N_BINS)
+#define TALLY_DZ(t) (PROBLEM_LZ/PROBLEM_N_BINS)
+#else
+#define TALLY_N(t) ((t)->n)
+#define TALLY_DX(t) ((t)->dx)
+#define TALLY_DY(t) ((t)->dy)
+#define TALLY_DZ(t) ((t)->dz)
+#endif
+
+#ifdef PROBLEM_NU
+#define NU(p) PROBLEM_NU
+#define FORCED_COLLISION(p) PROBLEM_FORCED_COLLISION
+#define EXP_TRANSFORM(p) PROBLEM_EXP_TRANSFORM
+#define WEIGHT_CUTOFF(p) PROBLEM_WEIGHT_CUTOFF
+#else
+#define NU(p) ((p)->nu)
+#define FORCED_COLLISION(p) ((p)->forced_collision)
+#define EXP_TRANSFORM(p) ((p)->exp_transform)
+#define WEIGHT_CUTOFF(p) ((p)->weight_cutoff)
+#endif
 
 typedef struct Parameters_{
   unsigned long long seed; // RNG seed
@@ -48,9 +167,22 @@ typedef struct Parameters_{
   int n_generations; // number of generations per batch
   int n_active; // number of active batches
   int bc; // boundary conditions
+  int symmetry; // symmetry of the domain, modeled by its fundamental octant
+  int population_control; // how the source bank is built from fission sites
+  double population_float; // fraction the population may float by
+  int fission_banking; // whether fission sites are banked on fission or at every collision
+  int mode; // eigenvalue, or forward or adjoint fixed source
+  int solver; // Monte Carlo or random ray solver of the eigenvalue problem
+  double ray_dead_length; // distance a random ray travels before it scores
+  double ray_active_length; // distance a random ray scores over
+  int geometry; // geometry type
   int n_nuclides; // number of nuclides in material
   int tally; // whether to tally
   int n_bins; // number of bins in each dimension of mesh
+  int n_threads; // number of threads
+  int pin_threads; // whether to pin threads to cores
+  int huge_pages; // how to back banks and tallies with huge pages
+  int simd; // SIMD variant of the kernels, or auto to pick from the cpu
   double nu; // average number of fission neutrons produced
   double xs_a; // absorption macro xs
   double xs_s; // scattering macro xs
@@ -58,8 +190,30 @@ typedef struct Parameters_{
   double Lx; // domain length in x
   double Ly; // domain length in y
   double Lz; // domain length in z
+  double region[6]; // box region of interest {x0, x1, y0, y1, z0, z1}
+  double source_region[6]; // box the fixed source is sampled in
+  int forced_collision; // whether to force collisions in the region
+  double exp_transform; // exponential transform stretching parameter
+  double exp_direction[3]; // preferred direction of the exponential transform
+  double weight_cutoff; // weight below which Russian roulette is played
+  int point_detector; // whether to estimate the flux at a point detector
+  double detector[3]; // position of the point detector
+  double exclusion_radius; // radius around the detector within which the flux is averaged
   int load_source; // load the source bank from source.dat
   int save_source; // save the source bank at end of simulation
+  int resume; // whether to resume from the restart file
+  double shutdown_deadline; // seconds after SIGTERM by which the restart file is written
+  int surface_write; // surface whose crossings are written to the surface source file
+  int surface_read; // whether a fixed source is sampled from the surface source file
+  int surface_reuse; // number of times each surface source site is used in a row
+  double cache_size; // MB the source cache may grow to before old entries are evicted
+  int cached_inactive; // number of inactive batches when starting from a cached source
+  int cached_source; // whether the run started from a cached source, set at run time
+  double cache_tolerance; // largest relative parameter difference to use a cached source
+  int depletion_steps; // number of burnup steps
+  double step_length; // length of each burnup step (days)
+  double power; // power the flux is normalized to when depleting (W)
+  int depletion_inactive; // number of inactive batches of each burnup step after the first
   int write_tally; // whether to output tallies
   int write_entropy; // whether to output shannon entropy
   int write_keff; // whether to output keff
@@ -70,29 +224,101 @@ typedef struct Parameters_{
   char *keff_file; // path to write keff to
   char *bank_file; // path to write particle bank to
   char *source_file; // path to write source distribution to
+  char *mesh_file; // path to read tetrahedral mesh from
+  char *problem_file; // path to write the header of a specialized build to
+  char *restart_file; // path to write the restart file to and resume from
+  char *source_cache; // directory of converged sources shared between runs
+  char *surface_file; // path to write the surface source to and read it from
+  char *source_plugin; // shared object that samples the source
+  char *source_plugin_args; // argument string passed to the source plugin
+  unsigned long source_chunk; // number of sites the source plugin samples per call
+  int profile; // whether to sample where the run spends its time
+  double profile_rate; // profiler samples per second of cpu time on each thread
+  int cost_map; // whether to map the events and time spent in each tally bin
+  char *cost_file; // path to write the cost map to
+  int energy; // whether to read the RAPL energy counters
+  char *benchmark_file; // path to write the run's metrics to as JSON, NULL for none
 } Parameters;
 
+// In-flight particle state read or written on every flight. It is sized to
+// fit one cache line and is also the record stored in the particle banks.
 typedef struct Particle_{
-  int alive;
+  double x; // position
+  double y;
+  double z;
+  double u; // direction
+  double v;
+  double w;
+  double weight;
+  int cell; // tet the particle is in, so meshes are limited to MAX_TETS tets
+  char alive;
+  char force; // whether the next flight in the region is forced to collide
+  char surface_crossed;
+  char pad;
+} Particle;
+
+_Static_assert(sizeof(Particle) == 64, "Particle must fit in one cache line");
+
+// Largest number of tets a mesh may have, the largest cell a particle holds
+#define MAX_TETS INT_MAX
+
+// Particle state rarely touched during tracking, kept for diagnostics and
+// physics extensions
+typedef struct Particle_Cold_{
   double energy;
   double last_energy;
   double mu; // cosine of polar angle
   double phi; // azimuthal angle
-  double u; // direction
-  double v;
-  double w;
-  double x; // position
-  double y;
-  double z;
-  int surface_crossed;
   int event;
-} Particle;
+} Particle_Cold;
+
+typedef struct BVHNode_{
+  double lo[3]; // bounding box of the tets below this node
+  double hi[3];
+  long first; // first tet of a leaf, or right child of an interior node
+  long n; // number of tets in a leaf, 0 for an interior node
+} BVHNode;
+
+typedef struct Mesh_{
+  long n_nodes;
+  long n_tets;
+  int n_materials;
+  double L[3]; // extent of the mesh in each dimension
+  double *xs; // fission, absorption and scattering macro xs of each material
+  double *nodes; // node coordinates
+  long *tets; // node indices of each tet, positively oriented
+  int *material; // material index of each tet
+  double *volume; // volume of each tet
+  long *neighbor; // 4*tet + face across each face, or -1 on the boundary
+  BVHNode *bvh; // bounding volume hierarchy for locating points
+  long *bvh_tets; // tet indices ordered by BVH leaf
+  long n_bvh; // number of BVH nodes
+} Mesh;
+
+// Source plugin loaded from a shared object
+typedef struct Source_Plugin_{
+  void *handle;
+  void *state; // state the plugin set up
+  int (*sample)(void *state, Source_Sites *sites);
+  void (*free)(void *state);
+  Source_Sites sites; // arrays of one chunk of sites
+  unsigned long chunk; // number of sites per call
+  unsigned long n_sampled; // number of sites sampled so far
+  double t_sample; // time spent in the plugin
+} Source_Plugin;
 
 typedef struct Geometry_{
+  int type;
   int bc;
+  int symmetry; // with octant symmetry the box is the lower octant and its upper faces reflect
   double Lx;
   double Ly;
   double Lz;
+  double region[6]; // box region of interest {x0, x1, y0, y1, z0, z1}
+  double source[6]; // box a fixed source is sampled in
+  Source_Plugin *plugin; // samples the source instead of the source box, or NULL
+  int n_materials;
+  Mesh *mesh; // tetrahedral mesh, NULL for a box
 } Geometry;
 
 typedef struct Nuclide_{
@@ -112,80 +338,259 @@ typedef struct Material_{
   Nuclide *nuclides;
 } Material;
 
+typedef struct Bank_{
+  unsigned long n; // number of particles
+  unsigned long sz; // size of bank
+  Particle *p; // particle array
+  void (*resize)(struct Bank_ *b);
+} Bank;
+
 typedef struct Tally_{
   int tallies_on; // whether tallying is currently turned on
   int n; // mumber of grid boxes in each dimension 
+  unsigned long sz; // total number of grid boxes
+  double *volume; // volume of each tet when tallying on the geometry mesh
   double dx; // grid spacing
   double dy;
   double dz;
   double *flux;
+  double *region; // box region of interest
+  double region_flux; // flux integrated over the region
+  double *region_batch; // region flux of each active batch
+  double *detector; // position of the point detector
+  double point_flux; // flux at the point detector
+  double *point_batch; // point detector flux of each active batch
+  Bank *surface; // particles that crossed the surface source surface
+  int n_materials;
+  int *cell_material; // material of each tet, NULL for a box
+  double *material_flux; // flux integrated over each material when depleting
+  int symmetry; // whether the mesh covers the fundamental octant of the domain
+  double *cost; // N_COSTS counters of each bin for the cost map, NULL without one
 } Tally;
 
-typedef struct Bank_{
-  unsigned long n; // number of particles
-  unsigned long sz; // size of bank
-  Particle *p; // particle array
-  void (*resize)(struct Bank_ *b);
-} Bank;
+// Particle crossing a surface as stored in a surface source file
+typedef struct Surface_Site_{
+  double x; // position
+  double y;
+  double z;
+  float u; // direction
+  float v;
+  float w;
+  float weight;
+} Surface_Site;
+
+typedef struct Surface_Source_{
+  unsigned long n; // number of sites
+  double n_histories; // source particles the sites were recorded from
+  Surface_Site *sites;
+} Surface_Source;
+
+// Counters of a run at a generation boundary, saved in the restart file. The
+// batch i_b has been started and generation i_g of it is next.
+typedef struct Restart_{
+  int i_b; // batch to resume in
+  int i_g; // generation of the batch to resume at
+  int i_a; // index of the batch among the active batches
+  unsigned long n_done; // number of particles simulated so far
+  double keff_batch; // keff summed over the generations of the batch so far
+  double H; // shannon entropy of the source bank
+  unsigned long long seed; // seed of the STREAM_OTHER random number sequence
+} Restart;
+
+// Kernels with SIMD variants, and the variant each one runs
+typedef struct Kernels_{
+  double (*box_distance)(Geometry *geometry, Particle *p);
+  int box_distance_variant;
+  void (*calculate_xs)(Material *material);
+  int calculate_xs_variant;
+  void (*count_sites)(Particle *p, unsigned long n_p, double *d, unsigned long n, unsigned long *count, int shared);
+  int count_sites_variant;
+} Kernels;
+
+typedef struct Arena_{
+  char *p; // block reserved for scratch arrays
+  size_t sz; // size of the block
+  size_t used; // bytes handed out since the last reset
+  size_t peak; // most bytes in use at once
+} Arena;
+
+typedef struct Pool_{
+  int n_threads; // number of threads, including the main thread
+  int pin; // whether threads are pinned to cores
+  int n_spin; // number of polls before a waiting thread sleeps
+  pthread_t *threads; // worker threads
+  void (*task)(void *arg, int id); // task run in the current phase
+  void *arg; // argument passed to the task
+  int phase; // phase counter that parked workers wait on
+  int running; // number of workers still running the current phase
+  int shutdown; // whether workers should exit
+  int n_started; // number of workers started
+  double *busy; // time each thread spent in the last phase
+  long n_dispatch; // number of phases dispatched
+  double t_dispatch; // total time spent dispatching and waiting
+  unsigned long n_histories; // particles or rays transported over the run
+  unsigned long n_generations; // generations or iterations transported over the run
+  Arena *scratch; // scratch arena of the main thread, which alone uses scratch
+} Pool;
 
 // io.c function prototypes
 void parse_parameters(Parameters *parameters);
 void read_CLI(int argc, char *argv[], Parameters *parameters);
 void print_error(char *message);
 void print_parameters(Parameters *parameters);
+void write_problem(Parameters *parameters, char *filename);
+void check_problem(Parameters *parameters);
 void border_print(void);
 void fancy_int(long a);
 void center_print(const char *s, int width);
 void init_output(Parameters *parameters);
 void write_tally(Tally *t, char *filename);
+void write_cost(Tally *t, char *filename);
+void write_benchmark(Parameters *parameters, Tally *tally, double *keff, double n_histories, double t, double *energy, char *filename);
 void write_entropy(double H, char *filename);
 void write_keff(double *keff, int n, char *filename);
 void write_bank(Bank *b, char *filename);
-void write_source(Parameters *parameters, Geometry *geometry, Bank *b, char *filename);
+void write_source(Parameters *parameters, Geometry *geometry, Bank *b, Arena *scratch, char *filename);
 void load_source(Bank *b);
 void save_source(Bank *b);
 
 // utils.c funtion prototypes
 double timer(void);
+unsigned long long cycle_count(void);
 void copy_particle(Particle *dest, Particle *source);
+double fom(double mean, double std, int n, double t);
 
 // prng.c function prototypes
 double rn(void);
-int rni(int min, int max);
+unsigned long rni(unsigned long min, unsigned long max);
 void set_stream(int rn_stream);
 void set_initial_seed(unsigned long long rn_seed0);
 void rn_skip(long long n);
+void rn_skip_seeds(long long first, unsigned long n, unsigned long long *seeds);
+unsigned long long get_seed(void);
+void set_seed(unsigned long long rn_seed);
 
 // initialize.c function prototypes
 Parameters *init_parameters(void);
 Geometry *init_geometry(Parameters *parameters);
-Tally *init_tally(Parameters *parameters);
-Material *init_material(Parameters *parameters);
+Tally *init_tally(Parameters *parameters, Geometry *geometry);
+Material *init_material(Parameters *parameters, Geometry *geometry);
 Bank *init_fission_bank(Parameters *parameters);
 Bank *init_source_bank(Parameters *parameters, Geometry *geometry);
 Bank *init_bank(unsigned long n_particles);
 void sample_source_particle(Geometry *geometry, Particle *p);
+void sample_box_particle(Geometry *geometry, double *box, Particle *p);
 void resize_particles(Bank *b);
 void free_bank(Bank *b);
-void free_material(Material *m);
+void free_geometry(Geometry *g);
+void free_material(Material *m, int n_materials);
 void free_tally(Tally *t);
 
 // transport.c function prototypes
 void transport(Parameters *parameters, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally, Particle *p);
 void calculate_xs(Material *material);
 double distance_to_boundary(Geometry *geometry, Particle *p);
-double distance_to_collision(Material *material);
-void cross_surface(Geometry *geometry, Particle *p);
-void collision(Material *material, Bank *fission_bank, double nu, Particle *p);
+double distance_to_collision(Parameters *parameters, Material *material, Particle *p);
+double exp_transform_weight(Parameters *parameters, Material *material, Particle *p, double d, int collided);
+double distance_to_region(double *r, Particle *p, int *inside);
+void russian_roulette(Parameters *parameters, Particle *p);
+void cross_surface(Parameters *parameters, Geometry *geometry, Tally *tally, Particle *p);
+void collision(Parameters *parameters, Material *material, Bank *fission_bank, Particle *p, Particle_Cold *c);
 void sample_fission_particle(Particle *p, Particle *p_old);
 
 // eigenvalue.c function prototypes
-void run_eigenvalue(Parameters *parameters, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally, double *keff);
+int run_eigenvalue(Parameters *parameters, Pool *pool, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally, double *keff);
+int run_fixed_source(Parameters *parameters, Pool *pool, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally);
 void synchronize_bank(Bank *source_bank, Bank *fission_bank);
-double shannon_entropy(Geometry *geometry, Bank *b);
+double bank_weight(Bank *b);
+void comb_bank(Parameters *parameters, Bank *source_bank, Bank *fission_bank);
+double shannon_entropy(Pool *pool, Geometry *geometry, Bank *b);
 void calculate_keff(double *keff, double *mean, double *std, int n);
 
 // tally.c function prototypes
 void score_tally(Parameters *parameters, Material *material, Tally *t, Particle *p);
+void score_cost(Tally *t, Particle *p, int event, unsigned long long *tsc);
+double cost_total(Tally *t, int counter);
+
+// memory.c function prototypes
+void set_huge_pages(int huge_pages);
+void *huge_malloc(size_t size);
+void *huge_calloc(size_t n, size_t size);
+void *huge_realloc(void *ptr, size_t old_size, size_t size);
+void huge_free(void *ptr);
+int huge_mapped(void *ptr);
+void huge_page_usage(unsigned long *n_huge, unsigned long *n_total);
+Arena *init_arena(void);
+void arena_reserve(Arena *a, size_t size);
+void *arena_alloc(Arena *a, size_t size);
+void arena_reset(Arena *a);
+void free_arena(Arena *a);
+
+// mesh.c function prototypes
+Mesh *load_mesh(char *filename);
+long locate_tet(Mesh *m, double *x);
+double distance_to_tet_face(Mesh *m, Particle *p);
+void cross_tet_face(Geometry *geometry, Particle *p);
+void free_mesh(Mesh *m);
+
+// restart.c function prototypes
+extern volatile sig_atomic_t shutdown_requested;
+void init_signals(void);
+int past_deadline(Parameters *parameters, unsigned long n_done, unsigned long n_left, double t_start);
+void write_restart(Parameters *parameters, Restart *r, Bank *source_bank, Tally *tally, double *keff);
+void read_restart(Parameters *parameters, Restart *r, Bank *source_bank, Tally *tally, double *keff);
+void resume_batches(Parameters *parameters);
+
+// detector.c function prototypes
+double optical_depth(Geometry *geometry, Material *material, Particle *p, double *x);
+void score_point_detector(Parameters *parameters, Geometry *geometry, Material *material, Tally *t, Particle *p, double ratio);
+
+// surface.c function prototypes
+void init_surface_file(Parameters *parameters);
+void write_surface_sites(Parameters *parameters, Tally **tallies, int n_threads, double n_histories);
+Surface_Source *read_surface_source(char *filename);
+void sample_surface_source(Parameters *parameters, Geometry *geometry, Surface_Source *s, unsigned long first, Bank *b);
+void free_surface_source(Surface_Source *s);
+
+// plugin.c function prototypes
+Source_Plugin *load_source_plugin(Parameters *parameters, Geometry *geometry);
+void sample_plugin_source(Source_Plugin *sp, Geometry *geometry, unsigned long first, unsigned long n, Bank *b);
+void free_source_plugin(Source_Plugin *sp);
+
+// random_ray.c function prototypes
+int run_random_ray(Parameters *parameters, Pool *pool, Geometry *geometry, Material *material, Tally *tally, double *keff);
+
+// profiler.c function prototypes
+extern const char *PHASE_NAMES[N_PHASES];
+extern double phase_time[N_PHASES];
+extern double phase_energy[N_PHASES];
+void set_phase(int phase);
+void reset_phase_times(void);
+void init_profiler(Parameters *parameters);
+void profile_thread(void);
+void print_profile(void);
+
+// energy.c function prototypes
+void init_energy(Parameters *parameters);
+int read_energy(double *package, double *dram);
+void free_energy(void);
+
+// depletion.c function prototypes
+void deplete(Parameters *parameters, Geometry *geometry, Material *material, Tally *tally);
+int run_depletion(Parameters *parameters, Pool *pool, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally, double *keff);
+
+// cache.c function prototypes
+int load_cached_source(Parameters *parameters, Geometry *geometry, Bank *b);
+void store_cached_source(Parameters *parameters, Geometry *geometry, Bank *b);
+
+// simd.c function prototypes
+extern Kernels kernels;
+void init_kernels(Parameters *parameters);
+void print_kernels(void);
+
+// pool.c function prototypes
+Pool *init_pool(Parameters *parameters);
+void pool_run(Pool *pool, void (*task)(void *arg, int id), void *arg);
+void free_pool(Pool *pool);
 
 #endif
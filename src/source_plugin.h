@@ -0,0 +1,54 @@
+#ifndef SOURCE_PLUGIN
+#define SOURCE_PLUGIN
+
+// Interface of external source plugins: shared objects, loaded with dlopen,
+// that sample source sites for sources sample_source_particle() can't
+// describe. The plugin fills arrays of up to source_chunk sites per call, so
+// the cost of the call is spread over many sites. A plugin defines
+//
+//   int source_version(void)
+//     returns SOURCE_PLUGIN_VERSION of the header it was built against
+//   int source_init(const char *args, const double *L, void **state)
+//     sets up the plugin from the source_plugin_args string and the domain
+//     extent L[3], and sets *state to whatever it needs later
+//   int source_sample(void *state, Source_Sites *sites)
+//     fills sites->n sites, drawing the random numbers of site i from its own
+//     substream with source_rn(&sites->seed[i])
+//   void source_free(void *state)
+//
+// The int functions return 0 on success. Sites must lie in the domain; their
+// directions are normalized by the code.
+
+#define SOURCE_PLUGIN_VERSION 2
+
+// The code's linear congruential generator, seed = (mult*seed + 1) % 2^48, so
+// a plugin draws its random numbers inline without calling back into the code
+#define SOURCE_RN_MULT 19073486328125ULL
+#define SOURCE_RN_MASK 281474976710655ULL
+
+// Advances the substream whose state is *seed and returns a uniform random
+// number in [0, 1)
+static inline double source_rn(unsigned long long *seed)
+{
+  *seed = (SOURCE_RN_MULT*(*seed) + 1) & SOURCE_RN_MASK;
+
+  return (double) *seed/(SOURCE_RN_MASK + 1);
+}
+
+// Source sites as a structure of arrays, each sites->n long. Each site of the
+// run has its own substream, so the sites don't depend on how they are split
+// into calls; the code sets seed[i] to the start of the substream of site i.
+typedef struct Source_Sites_{
+  unsigned long n; // number of sites to fill
+  unsigned long long *seed; // random number state of each site
+  double *x; // position
+  double *y;
+  double *z;
+  double *u; // direction
+  double *v;
+  double *w;
+  double *energy; // energy (MeV), unused by the one-group physics
+  double *weight;
+} Source_Sites;
+
+#endif
@@ -0,0 +1,12 @@
+#!/bin/bash
+# Builds the example beam source plugin and reports the rate it samples sites
+# at for a range of sites per call. Arguments are passed to every run, e.g.
+#   ./source_plugin.sh -particles 1000000 -batches 2
+
+make -s transport beam_source.so || exit 1
+
+for chunk in 1 16 256 4096 65536; do
+  rate=$(./transport -mode forward -bc vacuum -source_plugin ./beam_source.so \
+     -source_chunk $chunk "$@" | awk '/^Source plugin rate:/ {print $4}')
+  echo "Sites per call $chunk: $rate sites/sec"
+done
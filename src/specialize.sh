@@ -0,0 +1,40 @@
+#!/bin/bash
+# Builds a transport executable specialized to a problem and reports its
+# speedup over the generic build. Arguments are passed to both executables
+# and used to generate the specialized header, e.g.
+#   ./specialize.sh -particles 1000000 -batches 10 -active 5
+# The number of timed runs of each executable can be set with RUNS.
+
+RUNS=${RUNS:-3}
+
+make -s transport || exit 1
+make -s specialized ARGS="$*" || exit 1
+
+# Best simulation time over the runs, and the keff lines of the last run
+best_time() {
+  local best="" t
+  for((i=0; i<RUNS; i++)); do
+    "$@" > specialize.out || exit 1
+    t=$(awk '/^Simulation time:/ {print $3}' specialize.out)
+    if [ -z "$best" ] || awk "BEGIN {exit !($t < $best)}"; then
+      best=$t
+    fi
+  done
+  echo "$best"
+}
+
+t_generic=$(best_time ./transport "$@")
+grep -E '^[0-9]+ ' specialize.out > specialize.generic
+t_specialized=$(best_time ./transport_specialized "$@")
+grep -E '^[0-9]+ ' specialize.out > specialize.specialized
+
+echo "Generic:     $t_generic secs"
+echo "Specialized: $t_specialized secs"
+awk "BEGIN {printf \"Speedup:     %.3f\n\", $t_generic/$t_specialized}"
+if cmp -s specialize.generic specialize.specialized; then
+  echo "Results:     identical"
+else
+  echo "Results:     differ"
+fi
+
+rm -f specialize.out specialize.generic specialize.specialized
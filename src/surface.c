@@ -0,0 +1,172 @@
+#include "simple_mc.h"
+
+// Surface source files hold the particles that crossed a surface of one run so
+// a later fixed source run can start from that surface. The file is laid out
+// as
+//   magic               char[8]
+//   n_sites             unsigned long
+//   n_histories         double, source particles the sites were recorded from
+//   sites               Surface_Site[n_sites]
+// The header is rewritten each time sites are appended, so a run stopped at a
+// generation boundary leaves a consistent file.
+
+// Identifies a surface source file and its layout version
+static const char MAGIC[8] = "SMCSSF1";
+
+// Creates an empty surface source file
+void init_surface_file(Parameters *parameters)
+{
+  unsigned long n = 0;
+  double n_histories = 0;
+  FILE *fp;
+
+  fp = fopen(parameters->surface_file, "wb");
+  if(fp == NULL){
+    print_error("Couldn't open surface source file.");
+  }
+  fwrite(MAGIC, sizeof(char), 8, fp);
+  fwrite(&n, sizeof(unsigned long), 1, fp);
+  fwrite(&n_histories, sizeof(double), 1, fp);
+  fclose(fp);
+
+  return;
+}
+
+// Appends the sites recorded by each thread, in thread order, and adds
+// n_histories to the number of source particles they came from
+void write_surface_sites(Parameters *parameters, Tally **tallies, int n_threads, double n_histories)
+{
+  int i_t;
+  unsigned long i, n;
+  double h;
+  Bank *b;
+  Surface_Site s;
+  FILE *fp;
+
+  set_phase(PHASE_IO);
+
+  fp = fopen(parameters->surface_file, "r+b");
+  if(fp == NULL){
+    print_error("Couldn't open surface source file.");
+  }
+  fseek(fp, 8, SEEK_SET);
+  if(fread(&n, sizeof(unsigned long), 1, fp) != 1 || fread(&h, sizeof(double), 1, fp) != 1){
+    print_error("Error reading surface source file.");
+  }
+
+  fseek(fp, 0, SEEK_END);
+  for(i_t=0; i_t<n_threads; i_t++){
+    b = tallies[i_t]->surface;
+    for(i=0; i<b->n; i++){
+      s.x = b->p[i].x;
+      s.y = b->p[i].y;
+      s.z = b->p[i].z;
+      s.u = b->p[i].u;
+      s.v = b->p[i].v;
+      s.w = b->p[i].w;
+      s.weight = b->p[i].weight;
+      fwrite(&s, sizeof(Surface_Site), 1, fp);
+    }
+    n += b->n;
+    b->n = 0;
+  }
+  h += n_histories;
+
+  fseek(fp, 8, SEEK_SET);
+  fwrite(&n, sizeof(unsigned long), 1, fp);
+  fwrite(&h, sizeof(double), 1, fp);
+  if(fclose(fp) != 0){
+    print_error("Error writing surface source file.");
+  }
+
+  return;
+}
+
+Surface_Source *read_surface_source(char *filename)
+{
+  char magic[8];
+  Surface_Source *s = malloc(sizeof(Surface_Source));
+  FILE *fp;
+
+  fp = fopen(filename, "rb");
+  if(fp == NULL){
+    print_error("Couldn't open surface source file.");
+  }
+  if(fread(magic, sizeof(char), 8, fp) != 8 || memcmp(magic, MAGIC, 8) != 0){
+    print_error("Not a surface source file.");
+  }
+  if(fread(&(s->n), sizeof(unsigned long), 1, fp) != 1 ||
+     fread(&(s->n_histories), sizeof(double), 1, fp) != 1){
+    print_error("Error reading surface source file.");
+  }
+  if(s->n == 0){
+    print_error("Surface source file has no sites.");
+  }
+  s->sites = malloc(s->n*sizeof(Surface_Site));
+  if(fread(s->sites, sizeof(Surface_Site), s->n, fp) != s->n){
+    print_error("Error reading surface source file.");
+  }
+  fclose(fp);
+
+  return s;
+}
+
+// Fills the bank with n_particles source particles from the surface source,
+// walking the sites in order from site number first/reuse so each site is
+// used reuse times in a row. Each particle carries the weight of its site
+// times n_sites/n_histories, so tallies are per source particle of the run
+// that wrote the file.
+void sample_surface_source(Parameters *parameters, Geometry *geometry, Surface_Source *s, unsigned long first, Bank *b)
+{
+  unsigned long j;
+  double norm;
+  double x[3];
+  Surface_Site *site;
+  Particle *p;
+
+  while(b->sz < parameters->n_particles){
+    b->resize(b);
+  }
+
+  for(j=0; j<parameters->n_particles; j++){
+    site = &(s->sites[(first + j)/parameters->surface_reuse % s->n]);
+    p = &(b->p[j]);
+
+    norm = sqrt((double)site->u*site->u + (double)site->v*site->v + (double)site->w*site->w);
+    p->x = site->x;
+    p->y = site->y;
+    p->z = site->z;
+    p->u = site->u/norm;
+    p->v = site->v/norm;
+    p->w = site->w/norm;
+    p->weight = site->weight*s->n/s->n_histories;
+    p->alive = TRUE;
+    p->force = TRUE;
+
+    // Sites lie on a surface, so locate them in the mesh a little way along
+    // their direction
+    if(geometry->type == TET_MESH){
+      x[0] = p->x + 1.0e-9*p->u;
+      x[1] = p->y + 1.0e-9*p->v;
+      x[2] = p->z + 1.0e-9*p->w;
+      if((p->cell = locate_tet(geometry->mesh, x)) < 0){
+        print_error("Surface source site lies outside the mesh");
+      }
+    }
+    else if(p->x < 0 || p->x > geometry->Lx || p->y < 0 || p->y > geometry->Ly ||
+       p->z < 0 || p->z > geometry->Lz){
+      print_error("Surface source site lies outside the box");
+    }
+  }
+  b->n = parameters->n_particles;
+
+  return;
+}
+
+void free_surface_source(Surface_Source *s)
+{
+  free(s->sites);
+  free(s);
+
+  return;
+}
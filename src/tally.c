@@ -4,18 +4,83 @@
 void score_tally(Parameters *parameters, Material *material, Tally *t, Particle *p)
 {
   int ix, iy, iz;
+  unsigned long i;
   double vol;
 
-  // Volume
-  vol = t->dx * t->dy * t->dz;
+  // On a tet mesh the particle's tet is the tally bin
+  if(t->volume != NULL){
+    i = p->cell;
+    vol = t->volume[i];
+  }
+  else{
 
-  // Find the indices of the grid box of the particle
-  ix = p->x/t->dx;
-  iy = p->y/t->dy;
-  iz = p->z/t->dz;
+    // Volume
+    vol = TALLY_DX(t) * TALLY_DY(t) * TALLY_DZ(t);
+
+    // Find the indices of the grid box of the particle
+    ix = p->x/TALLY_DX(t);
+    iy = p->y/TALLY_DY(t);
+    iz = p->z/TALLY_DZ(t);
+    i = ix + (unsigned long)TALLY_N(t)*iy + (unsigned long)TALLY_N(t)*TALLY_N(t)*iz;
+  }
 
   // Scalar flux
-  t->flux[ix + t->n*iy + t->n*t->n*iz] += 1./(vol * material->xs_t * parameters->n_particles);
+  t->flux[i] += p->weight/(vol * XS_T(material) * parameters->n_particles);
+
+  // Flux integrated over the region of interest
+  if(p->x >= t->region[0] && p->x <= t->region[1] &&
+     p->y >= t->region[2] && p->y <= t->region[3] &&
+     p->z >= t->region[4] && p->z <= t->region[5]){
+    t->region_flux += p->weight/(XS_T(material) * parameters->n_particles);
+  }
+
+  // Flux integrated over each material for the depletion reaction rates
+  if(t->material_flux != NULL){
+    i = t->cell_material != NULL ? t->cell_material[p->cell] : 0;
+    t->material_flux[i] += p->weight/(XS_T(material) * parameters->n_particles);
+  }
+
+  return;
+}
+
+// Cost map: counts an event in the particle's bin and charges it the cycles
+// since the previous event of the history, which *tsc holds. Particles on the
+// outer boundary are counted in the bin inside it.
+void score_cost(Tally *t, Particle *p, int event, unsigned long long *tsc)
+{
+  int ix, iy, iz;
+  unsigned long i;
+  unsigned long long now = cycle_count();
+
+  if(t->volume != NULL){
+    i = p->cell;
+  }
+  else{
+    ix = p->x/TALLY_DX(t);
+    iy = p->y/TALLY_DY(t);
+    iz = p->z/TALLY_DZ(t);
+    if(ix >= TALLY_N(t)) ix = TALLY_N(t) - 1;
+    if(iy >= TALLY_N(t)) iy = TALLY_N(t) - 1;
+    if(iz >= TALLY_N(t)) iz = TALLY_N(t) - 1;
+    i = ix + (unsigned long)TALLY_N(t)*iy + (unsigned long)TALLY_N(t)*TALLY_N(t)*iz;
+  }
+
+  t->cost[N_COSTS*i + event] += 1;
+  t->cost[N_COSTS*i + COST_CYCLES] += now - *tsc;
+  *tsc = now;
 
   return;
 }
+
+// Sum of one cost map counter over the bins
+double cost_total(Tally *t, int counter)
+{
+  unsigned long i;
+  double sum = 0;
+
+  for(i=0; i<t->sz; i++){
+    sum += t->cost[N_COSTS*i + counter];
+  }
+
+  return sum;
+}
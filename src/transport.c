@@ -1,46 +1,157 @@
 #include "simple_mc.h"
 
+// Maximum number of uncollided particles from forced collisions waiting to be
+// transported
+#define N_SECONDARY 64
+
 // Main logic to move particle
 void transport(Parameters *parameters, Geometry *geometry, Material *material, Bank *source_bank, Bank *fission_bank, Tally *tally, Particle *p)
 {
   double d_b;
   double d_c;
+  double d_r;
   double d;
+  double P; // probability of colliding before leaving the region
+  int inside; // whether the flight starts in the region
+  int n_secondary = 0;
+  Particle secondary[N_SECONDARY];
+  Particle *q;
+  Particle_Cold c = {1, 1, 0, 0, 0};
+  Material *m = material;
+  unsigned long long tsc = 0; // cycle count at the last event, for the cost map
+
+  if(tally->cost != NULL){
+    tsc = cycle_count();
+  }
+
+  // Source event: the particle is emitted isotropically where it starts
+  if(parameters->point_detector == TRUE && tally->tallies_on == TRUE){
+    score_point_detector(parameters, geometry, material, tally, p, 1);
+  }
 
-  while(p->alive){
+  while(p->alive || n_secondary > 0){
+
+    // Pick up the uncollided part of an earlier forced collision
+    if(!p->alive){
+      n_secondary--;
+      copy_particle(p, &(secondary[n_secondary]));
+      continue;
+    }
+
+    // Find the material of the tet the particle is in
+    if(GEOMETRY_TYPE(geometry) == TET_MESH){
+      m = &(material[geometry->mesh->material[p->cell]]);
+    }
 
     // Recalculate macro xs if particle has changed energy
-    if(p->energy != p->last_energy){
-      calculate_xs(material);
+    if(c.energy != c.last_energy){
+      calculate_xs(m);
     }
 
     // Find distance to boundary
     d_b = distance_to_boundary(geometry, p);
 
+    // Find distance to the region boundary, which acts as a pseudo-surface
+    d_r = D_INF;
+    inside = FALSE;
+    if(FORCED_COLLISION(parameters) == TRUE){
+      d_r = distance_to_region(geometry->region, p, &inside);
+    }
+
+    // Force a collision on a flight that starts in the region: the uncollided
+    // part continues from where the flight leaves the region and the collided
+    // part collides within it
+    if(inside == TRUE && p->force == TRUE && XS_T(m) > 0 && n_secondary < N_SECONDARY){
+      d = d_b < d_r ? d_b : d_r;
+      P = 1 - exp(-XS_T(m)*d);
+
+      q = &(secondary[n_secondary++]);
+      copy_particle(q, p);
+      q->weight *= 1 - P;
+      q->x = q->x + d*q->u;
+      q->y = q->y + d*q->v;
+      q->z = q->z + d*q->w;
+      if(d_b <= d_r){
+        cross_surface(parameters, geometry, tally, q);
+      }
+      russian_roulette(parameters, q);
+      if(!q->alive){
+        n_secondary--;
+      }
+
+      // Sample the collision site from the exponential truncated to the region
+      d_c = -log(1 - rn()*P)/XS_T(m);
+      p->weight *= P;
+      p->force = FALSE;
+      p->x = p->x + d_c*p->u;
+      p->y = p->y + d_c*p->v;
+      p->z = p->z + d_c*p->w;
+
+      if(parameters->point_detector == TRUE && tally->tallies_on == TRUE){
+        score_point_detector(parameters, geometry, material, tally, p, m->xs_s/XS_T(m));
+      }
+      collision(parameters, m, fission_bank, p, &c);
+      if(tally->tallies_on == TRUE){
+        score_tally(parameters, m, tally, p);
+      }
+      if(tally->cost != NULL){
+        score_cost(tally, p, COST_COLLISIONS, &tsc);
+      }
+      russian_roulette(parameters, p);
+      continue;
+    }
+
     // Find distance to collision
-    d_c = distance_to_collision(material);
+    d_c = distance_to_collision(parameters, m, p);
 
-    // Take smaller of two distances
+    // Take smallest of the distances
     d = d_b < d_c ? d_b : d_c;
+    d = d < d_r ? d : d_r;
 
     // Advance particle
     p->x = p->x + d*p->u;
     p->y = p->y + d*p->v;
     p->z = p->z + d*p->w;
 
-    // Case where particle crosses boundary
-    if(d_b < d_c){
-      cross_surface(geometry, p);
+    // Correct the weight for the stretched flight distance
+    if(EXP_TRANSFORM(parameters) > 0){
+      p->weight *= exp_transform_weight(parameters, m, p, d, d_c < d_b && d_c < d_r);
     }
-    // Case where particle has collision
+
+    // Case where particle crosses into or out of the region; it is forced to
+    // collide again on its next flight in the region
+    if(d_r < d_b && d_r < d_c){
+      p->force = TRUE;
+      if(tally->cost != NULL){
+        score_cost(tally, p, COST_CROSSINGS, &tsc);
+      }
+    }
+    // Case where particle crosses boundary; the cost map counts the crossing
+    // in the cell being left
+    else if(d_b < d_c){
+      if(tally->cost != NULL){
+        score_cost(tally, p, COST_CROSSINGS, &tsc);
+      }
+      cross_surface(parameters, geometry, tally, p);
+    }
+    // Case where particle has collision; the point detector scores the
+    // expected scattering emission before the outcome is sampled
     else{
-      collision(material, fission_bank, parameters->nu, p);
+      if(parameters->point_detector == TRUE && tally->tallies_on == TRUE){
+        score_point_detector(parameters, geometry, material, tally, p, m->xs_s/XS_T(m));
+      }
+      collision(parameters, m, fission_bank, p, &c);
 
       // Score tallies
       if(tally->tallies_on == TRUE){
-        score_tally(parameters, material, tally, p);
+        score_tally(parameters, m, tally, p);
+      }
+      if(tally->cost != NULL){
+        score_cost(tally, p, COST_COLLISIONS, &tsc);
       }
     }
+
+    russian_roulette(parameters, p);
   }
   return;
 }
@@ -50,97 +161,173 @@ void transport(Parameters *parameters, Geometry *geometry, Material *material, B
 // cube
 void calculate_xs(Material *material)
 {
-  int i;
+  kernels.calculate_xs(material);
 
-  // Reset macroscopic cross sections to 0
-  material->xs_t = 0.0;
-  material->xs_f = 0.0;
-  material->xs_a = 0.0;
-  material->xs_s = 0.0;
+  return;
+}
 
-  for(i=0; i<material->n_nuclides; i++){
+// Returns the distance to the nearest boundary for a particle traveling in a
+// certain direction. On a tet mesh this is the face of the current tet.
+double distance_to_boundary(Geometry *geometry, Particle *p)
+{
+  if(GEOMETRY_TYPE(geometry) == TET_MESH){
+    return distance_to_tet_face(geometry->mesh, p);
+  }
 
-    Nuclide nuc = material->nuclides[i];
+  return kernels.box_distance(geometry, p);
+}
 
-    // Add contribution from this nuclide to total macro xs
-    material->xs_t += nuc.atom_density * nuc.xs_t;
+// Returns the total macro xs used to sample flight distances. With the
+// exponential transform the xs is reduced along the preferred direction and
+// increased against it, stretching flights toward the region of interest.
+static double sampling_xs(Parameters *parameters, Material *material, Particle *p)
+{
+  double mu;
 
-    // Add contribution from this nuclide to fission macro xs
-    material->xs_f += nuc.atom_density * nuc.xs_f;
+  if(EXP_TRANSFORM(parameters) <= 0){
+    return XS_T(material);
+  }
 
-    // Add contribution from this nuclide to absorption macro xs
-    material->xs_a += nuc.atom_density * nuc.xs_a;
+  mu = p->u*parameters->exp_direction[0] + p->v*parameters->exp_direction[1] +
+     p->w*parameters->exp_direction[2];
 
-    // Add contribution from this nuclide to scattering macro xs
-    material->xs_s += nuc.atom_density * nuc.xs_s;
+  return XS_T(material)*(1 - EXP_TRANSFORM(parameters)*mu);
+}
+
+// Returns the distance to the next collision for a particle
+double distance_to_collision(Parameters *parameters, Material *material, Particle *p)
+{
+  double d;
+  double xs = sampling_xs(parameters, material, p);
+
+  if(xs == 0){
+    d = D_INF;
+  }
+  else{
+    d = -log(rn())/xs;
   }
 
-  return;
+  return d;
 }
 
-// Returns the distance to the nearest boundary for a particle traveling in a
-// certain direction
-double distance_to_boundary(Geometry *geometry, Particle *p)
+// Returns the ratio of the true to the stretched probability of a flight of
+// length d, ending in a collision or not
+double exp_transform_weight(Parameters *parameters, Material *material, Particle *p, double d, int collided)
+{
+  double xs = sampling_xs(parameters, material, p);
+  double w = exp(-(XS_T(material) - xs)*d);
+
+  if(collided == TRUE){
+    w *= XS_T(material)/xs;
+  }
+
+  return w;
+}
+
+// Returns the distance along the particle's direction to the boundary of the
+// box region r = {x0, x1, y0, y1, z0, z1}: to where it leaves the region if
+// the flight starts inside, otherwise to where it enters it. Whether the
+// flight starts inside is decided from the direction as well as the position,
+// so a particle sitting on the region boundary is never stuck there.
+double distance_to_region(double *r, Particle *p, int *inside)
 {
   int i;
-  double dist;
-  double d = D_INF;
-  int    surfaces[6] = {X0, X1, Y0, Y1, Z0, Z1};
-  double p_angles[6] = {p->u, p->u, p->v, p->v, p->w, p->w};
-  double p_coords[6] = {p->x, p->x, p->y, p->y, p->z, p->z};
-  double s_coords[6] = {0, geometry->Lx, 0, geometry->Ly, 0, geometry->Lz};
-  
-  for(i=0; i<6; i++){
-    if(p_angles[i] == 0){
-      dist = D_INF;
+  double t0, t1, tmp;
+  double t_near = -D_INF;
+  double t_far = D_INF;
+  double x[3] = {p->x, p->y, p->z};
+  double u[3] = {p->u, p->v, p->w};
+
+  *inside = FALSE;
+
+  for(i=0; i<3; i++){
+    if(u[i] == 0){
+      if(x[i] < r[2*i] || x[i] > r[2*i+1]) return D_INF;
     }
     else{
-      dist = (s_coords[i] - p_coords[i])/p_angles[i];
-      if(dist <= 0){
-        dist = D_INF;
+      t0 = (r[2*i] - x[i])/u[i];
+      t1 = (r[2*i+1] - x[i])/u[i];
+      if(t0 > t1){
+        tmp = t0;
+        t0 = t1;
+        t1 = tmp;
       }
-    }
-    if(dist < d){
-      d = dist;
-      p->surface_crossed = surfaces[i];
+      if(t0 > t_near) t_near = t0;
+      if(t1 < t_far) t_far = t1;
     }
   }
 
-  return d;
+  if(t_near >= t_far || t_far <= 0){
+    return D_INF;
+  }
+  if(t_near <= 0){
+    *inside = TRUE;
+    return t_far;
+  }
+
+  return t_near;
 }
 
-// Returns the distance to the next collision for a particle
-double distance_to_collision(Material *material)
+// Plays Russian roulette with particles whose weight has dropped below the
+// cutoff, so survivors carry the weight of those killed
+void russian_roulette(Parameters *parameters, Particle *p)
 {
-  double d;
+  double w_s = 2*WEIGHT_CUTOFF(parameters);
 
-  if(material->xs_t == 0){
-    d = D_INF;
-  }
-  else{
-    d = -log(rn())/material->xs_t;
+  if(p->alive && p->weight < WEIGHT_CUTOFF(parameters)){
+    if(rn() < p->weight/w_s){
+      p->weight = w_s;
+    }
+    else{
+      p->alive = FALSE;
+    }
   }
 
-  return d;
+  return;
 }
 
 // Handles a particle crossing a surface in the geometry
-void cross_surface(Geometry *geometry, Particle *p)
+void cross_surface(Parameters *parameters, Geometry *geometry, Tally *tally, Particle *p)
 {
+  Bank *b = tally->surface;
+  int bc = BC(geometry);
+
+  // Move to the neighboring tet or apply the boundary condition on the mesh
+  if(GEOMETRY_TYPE(geometry) == TET_MESH){
+    cross_tet_face(geometry, p);
+    return;
+  }
+
+  // Record the particle as it leaves through the surface for a surface source
+  if(b != NULL && tally->tallies_on == TRUE &&
+     (parameters->surface_write == ALL_SURFACES || parameters->surface_write == p->surface_crossed)){
+    while(b->n >= b->sz){
+      b->resize(b);
+    }
+    copy_particle(&(b->p[b->n]), p);
+    b->n++;
+  }
+
+  // The upper faces of the fundamental octant are symmetry planes
+  if(geometry->symmetry == OCTANT && (p->surface_crossed == X1 ||
+     p->surface_crossed == Y1 || p->surface_crossed == Z1)){
+    bc = REFLECT;
+  }
+
   // Handle vacuum boundary conditions (particle leaks out)
-  if(geometry->bc == VACUUM){
+  if(bc == VACUUM){
     p->alive = FALSE;
   }
 
   // Handle reflective boundary conditions
-  else if(geometry->bc == REFLECT){
+  else if(bc == REFLECT){
     if(p->surface_crossed == X0){
       p->u = -p->u;
       p->x = 0.0;
     }
     else if(p->surface_crossed == X1){
       p->u = -p->u;
-      p->x = geometry->Lx;
+      p->x = LX(geometry);
     }
     else if(p->surface_crossed == Y0){
       p->v = -p->v;
@@ -148,7 +335,7 @@ void cross_surface(Geometry *geometry, Particle *p)
     }
     else if(p->surface_crossed == Y1){
       p->v = -p->v;
-      p->y = geometry->Ly;
+      p->y = LY(geometry);
     }
     else if(p->surface_crossed == Z0){
       p->w = -p->w;
@@ -156,26 +343,26 @@ void cross_surface(Geometry *geometry, Particle *p)
     }
     else if(p->surface_crossed == Z1){
       p->w = -p->w;
-      p->z = geometry->Lz;
+      p->z = LZ(geometry);
     }
   }
   
   // Handle periodic boundary conditions
-  else if(geometry->bc == PERIODIC){
+  else if(bc == PERIODIC){
     if(p->surface_crossed == X0){
-      p->x = geometry->Lx;
+      p->x = LX(geometry);
     }
     else if(p->surface_crossed == X1){
       p->x = 0;
     }
     else if(p->surface_crossed == Y0){
-      p->y = geometry->Ly;
+      p->y = LY(geometry);
     }
     else if(p->surface_crossed == Y1){
       p->y = 0;
     }
     else if(p->surface_crossed == Z0){
-      p->z = geometry->Lz;
+      p->z = LZ(geometry);
     }
     else if(p->surface_crossed == Z1){
       p->z = 0;
@@ -185,16 +372,39 @@ void cross_surface(Geometry *geometry, Particle *p)
   return;
 }
 
-void collision(Material *material, Bank *fission_bank, double nu, Particle *p)
+// Banks fission sites at the particle's location, sampling their number so
+// that its expectation is n
+static void bank_fission_sites(Bank *fission_bank, Particle *p, double n)
+{
+  int i;
+  int nf = n;
+
+  if(rn() <= n - nf){
+    nf++;
+  }
+
+  // Sample n new particles from the source distribution but at the current
+  // particle's location
+  while(fission_bank->n+nf >= fission_bank->sz){
+    fission_bank->resize(fission_bank);
+  }
+  for(i=0; i<nf; i++){
+    sample_fission_particle(&(fission_bank->p[fission_bank->n]), p);
+    fission_bank->n++;
+  }
+
+  return;
+}
+
+void collision(Parameters *parameters, Material *material, Bank *fission_bank, Particle *p, Particle_Cold *c)
 {
-  int nf;
   int i = 0;
   double prob = 0.0;
   double cutoff;
   Nuclide nuc = {0, 0, 0, 0, 0};
 
   // Cutoff for sampling nuclide
-  cutoff = rn()*material->xs_t;
+  cutoff = rn()*XS_T(material);
 
   // Sample which nuclide particle has collision with
   while(prob < cutoff){
@@ -206,44 +416,38 @@ void collision(Material *material, Bank *fission_bank, double nu, Particle *p)
   // Cutoff for sampling reaction
   cutoff = rn()*nuc.xs_t;
 
+  // With implicit banking every collision banks the expected number of fission
+  // sites, weight*nu*xs_f/xs_t, and fission is then just one way of being
+  // absorbed
+  if(parameters->fission_banking == IMPLICIT && nuc.xs_f > 0){
+    bank_fission_sites(fission_bank, p, p->weight*NU(parameters)*nuc.xs_f/nuc.xs_t);
+  }
+
   // Sample fission
   if(nuc.xs_f > cutoff){
 
-    // Sample number of fission neutrons produced
-    if(rn() > nu - (int)nu){
-      nf = nu;
-    }
-    else{
-      nf = nu + 1;
-    }
-
-    // Sample n new particles from the source distribution but at the current
-    // particle's location
-    if(fission_bank->n+nf >= fission_bank->sz){
-      fission_bank->resize(fission_bank);
-    }
-    for(i=0; i<nf; i++){
-      sample_fission_particle(&(fission_bank->p[fission_bank->n]), p);
-      fission_bank->n++;
+    // Sample number of fission neutrons produced, in expectation weight*nu
+    if(parameters->fission_banking == ANALOG){
+      bank_fission_sites(fission_bank, p, p->weight*NU(parameters));
     }
     p->alive = FALSE;
-    p->event = FISSION;
+    c->event = FISSION;
   }
 
   // Sample absorption (disappearance)
   else if(nuc.xs_a > cutoff){
     p->alive = FALSE;
-    p->event = ABSORPTION;
+    c->event = ABSORPTION;
   }
 
   // Sample scattering
   else{
-    p->mu = rn()*2 - 1;
-    p->phi = rn()*2*PI;
-    p->u = p->mu;
-    p->v = sqrt(1 - p->mu*p->mu) * cos(p->phi);
-    p->w = sqrt(1 - p->mu*p->mu) * sin(p->phi);
-    p->event = SCATTER;
+    c->mu = rn()*2 - 1;
+    c->phi = rn()*2*PI;
+    p->u = c->mu;
+    p->v = sqrt(1 - c->mu*c->mu) * cos(c->phi);
+    p->w = sqrt(1 - c->mu*c->mu) * sin(c->phi);
+    c->event = SCATTER;
   }
 
   return;
@@ -251,17 +455,19 @@ void collision(Material *material, Bank *fission_bank, double nu, Particle *p)
 
 void sample_fission_particle(Particle *p, Particle *p_old)
 {
+  double mu = rn()*2 - 1; // cosine of polar angle
+  double phi = rn()*2*PI; // azimuthal angle
+
   p->alive = TRUE;
-  p->energy = 1;
-  p->last_energy = 1;
-  p->mu = rn()*2 - 1;
-  p->phi = rn()*2*PI;
-  p->u = p->mu;
-  p->v = sqrt(1 - p->mu*p->mu)*cos(p->phi);
-  p->w = sqrt(1 - p->mu*p->mu)*sin(p->phi);
+  p->u = mu;
+  p->v = sqrt(1 - mu*mu)*cos(phi);
+  p->w = sqrt(1 - mu*mu)*sin(phi);
   p->x = p_old->x;
   p->y = p_old->y;
   p->z = p_old->z;
+  p->cell = p_old->cell;
+  p->weight = 1;
+  p->force = TRUE;
 
   return;
 }
@@ -0,0 +1,103 @@
+// Large-population checks of the random integers and the resampling of the
+// fission bank. Built and run with 'make uniformity'; prints PASS or FAIL for
+// each check and exits with status 1 if any fails. Each chi-square over K
+// buckets is turned into a standard normal by the Wilson-Hilferty transform
+// and fails beyond ZMAX.
+
+#include "simple_mc.h"
+
+// Buckets of each chi-square
+#define K 64
+
+// Largest |z| that passes
+#define ZMAX 4.0
+
+static int failed = FALSE;
+
+static void report(char *name, double *count, double expected)
+{
+  int i;
+  double chi2 = 0, w = 2.0/(9*(K - 1)), z;
+
+  for(i=0; i<K; i++){
+    chi2 += (count[i] - expected)*(count[i] - expected)/expected;
+  }
+  z = (pow(chi2/(K - 1), 1.0/3.0) - 1 + w)/sqrt(w);
+  if(fabs(z) > ZMAX) failed = TRUE;
+  printf("%s  %-48s chi2 %8.1f on %d dof  z = %7.3f\n", fabs(z) > ZMAX ? "FAIL" : "PASS",
+     name, chi2, K - 1, z);
+}
+
+// Draws of rni(0, range) fall evenly over K slices of the range, which are
+// equal when range is a multiple of K or much larger than it
+static void check_rni(unsigned long range, unsigned long n)
+{
+  unsigned long i;
+  double count[K] = {0};
+  char name[64];
+
+  for(i=0; i<n; i++){
+    count[(unsigned long)((unsigned __int128)rni(0, range)*K/range)]++;
+  }
+  snprintf(name, sizeof(name), "rni range %lu", range);
+  report(name, count, (double)n/K);
+}
+
+// Each fission site has the same chance of ending up in the source bank, for
+// a fission bank larger and smaller than the source bank. The sites carry
+// their index in x, and the selections are counted over K equal slices of
+// the fission bank.
+static void check_resampling(unsigned long n_f, unsigned long n_s, int repeats)
+{
+  unsigned long i;
+  int r;
+  double count[K] = {0};
+  char name[64];
+  Bank *source_bank = init_bank(n_s);
+  Bank *fission_bank = init_bank(n_f);
+
+  for(r=0; r<repeats; r++){
+    for(i=0; i<n_f; i++){
+      fission_bank->p[i].x = i;
+    }
+    fission_bank->n = n_f;
+    source_bank->n = n_s;
+    synchronize_bank(source_bank, fission_bank);
+    for(i=0; i<n_s; i++){
+      count[(unsigned long)source_bank->p[i].x*K/n_f]++;
+    }
+  }
+  snprintf(name, sizeof(name), "resampling %lu sites to %lu", n_f, n_s);
+  report(name, count, (double)n_s*repeats/K);
+
+  free_bank(source_bank);
+  free_bank(fission_bank);
+}
+
+int main(void)
+{
+  double a, b;
+
+  set_initial_seed(1);
+  set_stream(STREAM_OTHER);
+
+  check_rni(64000, 1000000);
+  check_rni(1UL << 31, 1000000);
+  check_rni(1UL << 44, 1000000);
+  check_rni(3UL << 47, 1000000);
+  check_rni(1UL << 62, 1000000);
+  check_rni(~0UL, 1000000);
+
+  check_resampling(3000000, 1000000, 4);
+  check_resampling(1000000, 3000000, 2);
+
+  // Particles a quarter period apart start from different seeds
+  rn_skip(12345);
+  a = rn();
+  rn_skip(12345 + (1LL << 46));
+  b = rn();
+  printf("%s  %-48s %.17g vs %.17g\n", a != b ? "PASS" : "FAIL", "rn_skip n and n + 2^46 differ", a, b);
+  if(a == b) failed = TRUE;
+
+  return failed == TRUE ? 1 : 0;
+}
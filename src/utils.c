@@ -1,27 +1,50 @@
 #include "simple_mc.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include<x86intrin.h>
+#endif
 
 double timer(void)
 {
-  struct timeval time;
-  gettimeofday(&time, 0);
-  return time.tv_sec + time.tv_usec/1000000.0;
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec/1000000000.0;
+}
+
+// Cheap fine-grained clock for the cost map: the time stamp counter where
+// there is one, nanoseconds otherwise
+unsigned long long cycle_count(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec*1000000000ULL + time.tv_nsec;
+#endif
 }
 
 void copy_particle(Particle *dest, Particle *source)
 {
-  dest->alive = source->alive;
-  dest->energy = source->energy;
-  dest->last_energy = source->last_energy;
-  dest->mu = source->mu;
-  dest->phi = source->phi;
-  dest->u = source->u;
-  dest->v = source->v;
-  dest->w = source->w;
   dest->x = source->x;
   dest->y = source->y;
   dest->z = source->z;
-  dest->event = source->event;
+  dest->u = source->u;
+  dest->v = source->v;
+  dest->w = source->w;
+  dest->weight = source->weight;
+  dest->cell = source->cell;
+  dest->alive = source->alive;
+  dest->force = source->force;
+  dest->surface_crossed = source->surface_crossed;
 
   return;
 }
 
+// Figure of merit 1/(R^2 T) of a quantity with the given batch mean and
+// standard deviation over n batches, taking time t
+double fom(double mean, double std, int n, double t)
+{
+  double r = std/sqrt(n)/mean;
+
+  return 1/(r*r*t);
+}
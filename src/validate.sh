@@ -0,0 +1,116 @@
+#!/bin/bash
+# Statistical validation of a transport engine. Engines that change the order
+# of the random numbers can't be compared bit for bit, so each check runs an
+# ensemble of independent seeds and tests the ensemble means:
+#   analytic   keff of an infinite medium, a reflective or periodic box of one
+#              nuclide, against k_inf = nu*xs_f/xs_a with a z-test
+#   keff       keff of the candidate against the reference engine with a
+#              two-sample z-test
+#   flux       mesh flux of the candidate against the reference with a
+#              chi-squared test over the bins
+# Arguments are passed to every candidate run, e.g.
+#   ./validate.sh -fission_banking implicit
+#   CANDIDATE=./transport_specialized ./validate.sh
+# or through 'make validate ARGS="..."'. The checks are set with
+#   REFERENCE   reference executable (./transport)
+#   CANDIDATE   candidate executable (./transport)
+#   REF_ARGS    arguments of every reference run ("")
+#   PROBLEM     arguments of the problem the engines are compared on
+#               ("-bc vacuum -Lx 100 -Ly 100 -Lz 100")
+#   SEEDS       runs in each ensemble (10)
+#   PARTICLES   particles per generation (20000)
+#   BATCHES     batches of each run (40), of which
+#   ACTIVE      are active (20)
+#   BINS        flux mesh bins in each dimension (4)
+#   ZMAX        largest |z| that passes (4)
+# The script prints PASS or FAIL for each check and exits with status 1 if
+# any check fails.
+
+REFERENCE=${REFERENCE:-./transport}
+CANDIDATE=${CANDIDATE:-./transport}
+REF_ARGS=${REF_ARGS:-""}
+PROBLEM=${PROBLEM:-"-bc vacuum -Lx 100 -Ly 100 -Lz 100"}
+SEEDS=${SEEDS:-10}
+PARTICLES=${PARTICLES:-20000}
+BATCHES=${BATCHES:-40}
+ACTIVE=${ACTIVE:-20}
+BINS=${BINS:-4}
+ZMAX=${ZMAX:-4}
+
+make -s transport || exit 1
+
+RUN="-particles $PARTICLES -batches $BATCHES -active $ACTIVE -write_keff false -write_entropy false"
+failed=0
+
+# Runs an ensemble of SEEDS runs, seeds first to first+SEEDS-1, of an
+# executable with the given arguments. Writes the keff mean of each run to
+# $out.keff and the flux of each run averaged over the active batches, one
+# run per line, to $out.flux.
+ensemble() {
+  local out=$1 first=$2 exe=$3
+  shift 3
+  rm -f $out.keff $out.flux
+  for((s=first; s<first+SEEDS; s++)); do
+    $exe $RUN -seed $s -tally true -bins $BINS -write_tally true \
+       -tally_file $out.tally "$@" > $out.out || { cat $out.out; exit 1; }
+    awk '/^[0-9]+ / && NF >= 6 {mean=$4} END {print mean}' $out.out >> $out.keff
+    awk -v a=$ACTIVE '{for(i=1; i<=NF; i++) f[n++] = $i}
+       END {m = n/a; for(j=0; j<m; j++) {s = 0; for(b=0; b<a; b++) s += f[b*m+j];
+          printf("%e ", s/a)} printf("\n")}' $out.tally >> $out.flux
+    rm -f $out.out $out.tally
+  done
+}
+
+# Prints PASS or FAIL for a check with statistic z
+report() {
+  local name=$1 z=$2 detail=$3
+  if awk "BEGIN {exit !($z < -$ZMAX || $z > $ZMAX)}"; then
+    printf "FAIL  %-40s z = %7.3f  %s\n" "$name" $z "$detail"
+    failed=1
+  else
+    printf "PASS  %-40s z = %7.3f  %s\n" "$name" $z "$detail"
+  fi
+}
+
+# Analytic infinite medium: nu xs_f xs_a xs_s
+for xs in "2.5 0.012 0.03 0.27" "2.0 0.05 0.08 0.2"; do
+  read nu xs_f xs_a xs_s <<< "$xs"
+  k_inf=$(awk "BEGIN {print $nu*$xs_f/$xs_a}")
+  for bc in reflective periodic; do
+    ensemble validate.cand 1 $CANDIDATE "$@" -bc $bc -nuclides 1 -nu $nu -xs_f $xs_f \
+       -xs_a $xs_a -xs_s $xs_s
+    read m se < <(awk '{n++; s += $1; s2 += $1*$1}
+       END {m = s/n; print m, sqrt((s2 - n*m*m)/(n - 1)/n)}' validate.cand.keff)
+    z=$(awk "BEGIN {print ($m - $k_inf)/$se}")
+    report "analytic k_inf=$k_inf bc=$bc" $z "keff $m +/- $se"
+  done
+done
+
+# Reference against candidate on the same problem, disjoint seeds
+ensemble validate.ref 1 $REFERENCE $PROBLEM $REF_ARGS
+ensemble validate.cand $((SEEDS+1)) $CANDIDATE $PROBLEM "$@"
+
+read z detail < <(paste validate.ref.keff validate.cand.keff | awk '{n++;
+   a += $1; a2 += $1*$1; b += $2; b2 += $2*$2}
+   END {ma = a/n; mb = b/n; va = (a2 - n*ma*ma)/(n - 1); vb = (b2 - n*mb*mb)/(n - 1);
+      printf("%f reference %f candidate %f\n", (mb - ma)/sqrt((va + vb)/n), ma, mb)}')
+report "keff candidate vs reference" $z "$detail"
+
+# Chi-squared over the bins of the difference of the ensemble mean fluxes,
+# turned into a standard normal by the Wilson-Hilferty transform. The
+# variances are estimated from the runs, which makes each term a squared t
+# with n_a + n_b - 2 degrees of freedom rather than a squared normal; the sum
+# is scaled by (d - 2)/d to bring its mean back to one per bin.
+read z detail < <(awk 'FNR == 1 {f++} {for(j=1; j<=NF; j++) {s[f,j] += $j;
+   s2[f,j] += $j*$j} n[f] = FNR; m = NF}
+   END {for(j=1; j<=m; j++) {ma = s[1,j]/n[1]; mb = s[2,j]/n[2];
+      va = (s2[1,j] - n[1]*ma*ma)/(n[1] - 1); vb = (s2[2,j] - n[2]*mb*mb)/(n[2] - 1);
+      v = va/n[1] + vb/n[2]; if(v > 0) {chi2 += (ma - mb)^2/v; k++}}
+   d = n[1] + n[2] - 2; chi2 *= (d - 2)/d;
+   w = 2/(9*k); printf("%f chi2 %.1f on %d bins\n", ((chi2/k)^(1/3) - 1 + w)/sqrt(w), chi2, k)}' \
+   validate.ref.flux validate.cand.flux)
+report "flux candidate vs reference" $z "$detail"
+
+rm -f validate.ref.keff validate.ref.flux validate.cand.keff validate.cand.flux
+
+exit $failed